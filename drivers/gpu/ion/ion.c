@@ -29,6 +29,7 @@
 #include <linux/mm_types.h>
 #include <linux/rbtree.h>
 #include <linux/rtmutex.h>
+#include <linux/scatterlist.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/seq_file.h>
@@ -1055,30 +1056,164 @@ end:
 }
 EXPORT_SYMBOL(ion_import_dma_buf);
 
-static int ion_sync_for_device(struct ion_client *client, int fd)
+/* drop the user mappings of one page, so the next cpu access faults */
+static void ion_buffer_zap_page(struct ion_buffer *buffer, unsigned long pgoff)
+{
+	struct ion_vma_list *vma_list;
+
+	list_for_each_entry(vma_list, &buffer->vmas, list) {
+		struct vm_area_struct *vma = vma_list->vma;
+		unsigned long addr;
+
+		if (pgoff < vma->vm_pgoff)
+			continue;
+		addr = vma->vm_start + ((pgoff - vma->vm_pgoff) << PAGE_SHIFT);
+		if (addr >= vma->vm_end)
+			continue;
+		zap_page_range(vma, addr, PAGE_SIZE, NULL);
+	}
+}
+
+/*
+ * Sync [offset, offset + len) of a cached buffer.  When cleaning a buffer
+ * with faulted in user mappings only dirty pages are written back, and
+ * they are unmapped again so that the next cpu write marks them dirty.
+ */
+static void ion_buffer_sync_range(struct ion_buffer *buffer,
+				  size_t offset, size_t len,
+				  enum dma_data_direction dir, bool for_device)
+{
+	bool track = for_device && ion_buffer_fault_user_mappings(buffer);
+	size_t end = offset + len;
+	size_t pos = 0;
+	struct scatterlist *sg, tmp;
+	int i;
+
+	mutex_lock(&buffer->lock);
+	for_each_sg(buffer->sg_table->sgl, sg, buffer->sg_table->nents, i) {
+		size_t sg_start = pos;
+		size_t start, stop;
+
+		pos += sg->length;
+		if (pos <= offset)
+			continue;
+		if (sg_start >= end)
+			break;
+
+		if (track) {
+			/* pagewise sg list: dirty state is per whole page */
+			if (!test_bit(i, buffer->dirty))
+				continue;
+			clear_bit(i, buffer->dirty);
+			ion_buffer_zap_page(buffer, i);
+			start = 0;
+			stop = sg->length;
+		} else {
+			start = max(offset, sg_start) - sg_start;
+			stop = min(end, pos) - sg_start;
+		}
+
+		sg_init_table(&tmp, 1);
+		sg_set_page(&tmp, sg_page(sg), stop - start, sg->offset + start);
+		sg_dma_address(&tmp) = sg_phys(&tmp);
+		if (for_device)
+			dma_sync_sg_for_device(NULL, &tmp, 1, dir);
+		else
+			dma_sync_sg_for_cpu(NULL, &tmp, 1, dir);
+	}
+	mutex_unlock(&buffer->lock);
+}
+
+static struct dma_buf *ion_sync_get_dma_buf(int fd)
 {
 	struct dma_buf *dmabuf;
-	struct ion_buffer *buffer;
 
 	dmabuf = dma_buf_get(fd);
 	if (IS_ERR_OR_NULL(dmabuf))
-		return PTR_ERR(dmabuf);
+		return dmabuf;
 
 	/* if this memory came from ion */
 	if (dmabuf->ops != &dma_buf_ops) {
 		pr_err("%s: can not sync dmabuf from another exporter\n",
 		       __func__);
 		dma_buf_put(dmabuf);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
+	return dmabuf;
+}
+
+static int ion_sync_for_device(struct ion_client *client, int fd)
+{
+	struct dma_buf *dmabuf;
+	struct ion_buffer *buffer;
+
+	dmabuf = ion_sync_get_dma_buf(fd);
+	if (IS_ERR_OR_NULL(dmabuf))
+		return PTR_ERR(dmabuf);
 	buffer = dmabuf->priv;
 
-	dma_sync_sg_for_device(NULL, buffer->sg_table->sgl,
-			       buffer->sg_table->nents, DMA_BIDIRECTIONAL);
+	ion_buffer_sync_range(buffer, 0, buffer->size, DMA_BIDIRECTIONAL,
+			      true);
 	dma_buf_put(dmabuf);
 	return 0;
 }
 
+static int ion_sync_range(struct ion_client *client,
+			  struct ion_sync_range_data *data)
+{
+	struct dma_buf *dmabuf;
+	struct ion_buffer *buffer;
+	size_t len = data->len;
+	int ret = 0;
+
+	if (!data->flags ||
+	    (data->flags & ~(ION_SYNC_CLEAN | ION_SYNC_INVALIDATE)))
+		return -EINVAL;
+
+	dmabuf = ion_sync_get_dma_buf(data->fd);
+	if (IS_ERR_OR_NULL(dmabuf))
+		return PTR_ERR(dmabuf);
+	buffer = dmabuf->priv;
+
+	if (data->offset > buffer->size) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (!len)
+		len = buffer->size - data->offset;
+	if (len > buffer->size - data->offset) {
+		ret = -EINVAL;
+		goto out;
+	}
+	/* uncached buffers have nothing to maintain */
+	if (!ion_buffer_cached(buffer))
+		goto out;
+
+	switch (data->flags) {
+	case ION_SYNC_CLEAN:
+		ion_buffer_sync_range(buffer, data->offset, len,
+				      DMA_TO_DEVICE, true);
+		break;
+	case ION_SYNC_INVALIDATE:
+		ion_buffer_sync_range(buffer, data->offset, len,
+				      DMA_FROM_DEVICE, false);
+		break;
+	default:
+		/*
+		 * The for_device path only cleans on ARMv7, and only dirty
+		 * pages of tracked buffers: invalidate the whole range after.
+		 */
+		ion_buffer_sync_range(buffer, data->offset, len,
+				      DMA_TO_DEVICE, true);
+		ion_buffer_sync_range(buffer, data->offset, len,
+				      DMA_FROM_DEVICE, false);
+		break;
+	}
+out:
+	dma_buf_put(dmabuf);
+	return ret;
+}
+
 static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	struct ion_client *client = filp->private_data;
@@ -1160,6 +1295,15 @@ static long ion_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		ion_sync_for_device(client, data.fd);
 		break;
 	}
+	case ION_IOC_SYNC_RANGE:
+	{
+		struct ion_sync_range_data data;
+
+		if (copy_from_user(&data, (void __user *)arg,
+				   sizeof(struct ion_sync_range_data)))
+			return -EFAULT;
+		return ion_sync_range(client, &data);
+	}
 	case ION_IOC_CUSTOM:
 	{
 		struct ion_device *dev = client->dev;
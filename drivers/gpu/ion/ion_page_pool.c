@@ -17,7 +17,10 @@
 #include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/module.h>
 #include <linux/slab.h>
@@ -27,8 +30,27 @@
 /* #define DEBUG_PAGE_POOL_SHRINKER */
 
 static struct plist_head pools = PLIST_HEAD_INIT(pools);
+/* serializes pool create/destroy against the pool thread's walks */
+static DEFINE_MUTEX(pools_lock);
 static struct shrinker shrinker;
 
+/*
+ * Pages freed to a pool are zeroed, and pools below their watermark are
+ * refilled, by a SCHED_IDLE thread, so that allocations served from the
+ * pools pay for neither. The watermark is in pages per pool; 0 turns
+ * refilling off. The thread leaves the pools alone for
+ * ION_PAGE_POOL_BACKOFF after the shrinker has had to take pages back.
+ */
+static unsigned int pool_watermark = 256;
+module_param(pool_watermark, uint, 0644);
+
+#define ION_PAGE_POOL_BACKOFF	HZ
+
+static struct task_struct *pool_task;
+static DECLARE_WAIT_QUEUE_HEAD(pool_waitqueue);
+static bool pool_work;
+static unsigned long pool_last_shrink;
+
 struct ion_page_pool_item {
 	struct page *page;
 	struct list_head list;
@@ -54,7 +76,32 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
-static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+/* zero a page freed to the pool and make it ready for dma again */
+static void ion_page_pool_zero(struct ion_page_pool *pool, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << pool->order); i++)
+		clear_highpage(page + i);
+	__dma_page_cpu_to_dev(page, 0, PAGE_SIZE << pool->order,
+			      DMA_BIDIRECTIONAL);
+}
+
+/* must be called with pool->mutex held */
+static void ion_page_pool_add_item(struct ion_page_pool *pool,
+				   struct ion_page_pool_item *item)
+{
+	if (PageHighMem(item->page)) {
+		list_add_tail(&item->list, &pool->high_items);
+		pool->high_count++;
+	} else {
+		list_add_tail(&item->list, &pool->low_items);
+		pool->low_count++;
+	}
+}
+
+static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page,
+			     bool dirty)
 {
 	struct ion_page_pool_item *item;
 
@@ -64,17 +111,64 @@ static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 
 	mutex_lock(&pool->mutex);
 	item->page = page;
-	if (PageHighMem(page)) {
-		list_add_tail(&item->list, &pool->high_items);
-		pool->high_count++;
+	if (dirty) {
+		list_add_tail(&item->list, &pool->dirty_items);
+		pool->dirty_count++;
 	} else {
-		list_add_tail(&item->list, &pool->low_items);
-		pool->low_count++;
+		ion_page_pool_add_item(pool, item);
 	}
 	mutex_unlock(&pool->mutex);
 	return 0;
 }
 
+/*
+ * The thread cannot look at the pools from its wait condition, which
+ * must not sleep on pools_lock, so wakers leave it a flag instead.
+ */
+static void ion_page_pool_wake(void)
+{
+	pool_work = true;
+	wake_up(&pool_waitqueue);
+}
+
+/* number of items the refill thread should keep in the pool */
+static int ion_page_pool_target(struct ion_page_pool *pool)
+{
+	return pool_watermark ? max(pool_watermark >> pool->order, 1U) : 0;
+}
+
+static bool ion_page_pool_backoff(void)
+{
+	return time_before(jiffies, pool_last_shrink + ION_PAGE_POOL_BACKOFF);
+}
+
+/*
+ * Only a hint for waking the pool thread, so it may also be called
+ * without pool->mutex.
+ */
+static bool ion_page_pool_needs_work(struct ion_page_pool *pool)
+{
+	if (pool->dirty_count)
+		return true;
+	return !ion_page_pool_backoff() &&
+		pool->high_count + pool->low_count < ion_page_pool_target(pool);
+}
+
+static struct page *ion_page_pool_remove_dirty(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_item *item;
+	struct page *page;
+
+	BUG_ON(!pool->dirty_count);
+	item = list_first_entry(&pool->dirty_items, struct ion_page_pool_item,
+				list);
+	pool->dirty_count--;
+	list_del(&item->list);
+	page = item->page;
+	kfree(item);
+	return page;
+}
+
 static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 {
 	struct ion_page_pool_item *item;
@@ -101,29 +195,129 @@ static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 void *ion_page_pool_alloc(struct ion_page_pool *pool)
 {
 	struct page *page = NULL;
+	bool dirty = false;
+	bool wake;
 
 	BUG_ON(!pool);
 
 	mutex_lock(&pool->mutex);
-	if (pool->high_count)
+	if (pool->high_count) {
 		page = ion_page_pool_remove(pool, true);
-	else if (pool->low_count)
+	} else if (pool->low_count) {
 		page = ion_page_pool_remove(pool, false);
+	} else if (pool->dirty_count) {
+		/* still cheaper than going to the page allocator */
+		page = ion_page_pool_remove_dirty(pool);
+		dirty = true;
+	}
+	if (page)
+		pool->hits++;
+	else
+		pool->misses++;
+	wake = ion_page_pool_needs_work(pool);
 	mutex_unlock(&pool->mutex);
 
-	if (!page)
+	if (wake)
+		ion_page_pool_wake();
+
+	if (dirty)
+		ion_page_pool_zero(pool, page);
+	else if (!page)
 		page = ion_page_pool_alloc_pages(pool);
 
 	return page;
 }
 
+/*
+ * Pages may be handed back with their old contents: they are zeroed
+ * before the pool gives them out again.
+ */
 void ion_page_pool_free(struct ion_page_pool *pool, struct page* page)
 {
 	int ret;
 
-	ret = ion_page_pool_add(pool, page);
+	ret = ion_page_pool_add(pool, page, true);
 	if (ret)
 		ion_page_pool_free_pages(pool, page);
+	else
+		ion_page_pool_wake();
+}
+
+/* zero everything on the dirty list, one item at a time */
+static void ion_page_pool_clean(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_item *item;
+
+	while (!kthread_should_stop()) {
+		mutex_lock(&pool->mutex);
+		if (!pool->dirty_count) {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		item = list_first_entry(&pool->dirty_items,
+					struct ion_page_pool_item, list);
+		list_del(&item->list);
+		pool->dirty_count--;
+		mutex_unlock(&pool->mutex);
+
+		ion_page_pool_zero(pool, item->page);
+
+		mutex_lock(&pool->mutex);
+		ion_page_pool_add_item(pool, item);
+		mutex_unlock(&pool->mutex);
+		cond_resched();
+	}
+}
+
+static void ion_page_pool_refill(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	while (!kthread_should_stop() && !ion_page_pool_backoff()) {
+		mutex_lock(&pool->mutex);
+		if (pool->high_count + pool->low_count >=
+		    ion_page_pool_target(pool)) {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		mutex_unlock(&pool->mutex);
+
+		page = ion_page_pool_alloc_pages(pool);
+		if (!page) {
+			/* memory is tight: back off as if we were shrunk */
+			pool_last_shrink = jiffies;
+			break;
+		}
+		if (ion_page_pool_add(pool, page, false)) {
+			/* no memory for the list item either: back off too */
+			ion_page_pool_free_pages(pool, page);
+			pool_last_shrink = jiffies;
+			break;
+		}
+		cond_resched();
+	}
+}
+
+static int ion_page_pool_thread(void *data)
+{
+	struct ion_page_pool *pool;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		wait_event_freezable(pool_waitqueue,
+				     pool_work || kthread_should_stop());
+		pool_work = false;
+		smp_mb();
+
+		mutex_lock(&pools_lock);
+		plist_for_each_entry(pool, &pools, list) {
+			ion_page_pool_clean(pool);
+			ion_page_pool_refill(pool);
+		}
+		mutex_unlock(&pools_lock);
+	}
+
+	return 0;
 }
 
 #ifdef DEBUG_PAGE_POOL_SHRINKER
@@ -166,13 +360,15 @@ static int debug_grow_pools_set(void *data, u64 val)
 	struct ion_page_pool *pool;
 	struct page *page;
 
+	mutex_lock(&pools_lock);
 	plist_for_each_entry(pool, &pools, list) {
 		if (val != pool->list.prio)
 			continue;
 		page = ion_page_pool_alloc_pages(pool);
-		if (page)
-			ion_page_pool_add(pool, page);
+		if (page && ion_page_pool_add(pool, page, false))
+			ion_page_pool_free_pages(pool, page);
 	}
+	mutex_unlock(&pools_lock);
 
 	return 0;
 }
@@ -190,6 +386,8 @@ static int ion_page_pool_total(bool high)
 		total += high ? (pool->high_count + pool->low_count) *
 			(1 << pool->order) :
 			pool->low_count * (1 << pool->order);
+		/* dirty pages are freed first, highmem or not */
+		total += pool->dirty_count * (1 << pool->order);
 	}
 	return total;
 }
@@ -208,12 +406,17 @@ static int ion_page_pool_shrink(struct shrinker *shrinker,
 	if (nr_to_scan == 0)
 		return ion_page_pool_total(high);
 
+	/* keep the refill thread from undoing our work right away */
+	pool_last_shrink = jiffies;
+
 	plist_for_each_entry(pool, &pools, list) {
 		for (i = 0; i < nr_to_scan; i++) {
 			struct page *page;
 
 			mutex_lock(&pool->mutex);
-			if (high && pool->high_count) {
+			if (pool->dirty_count) {
+				page = ion_page_pool_remove_dirty(pool);
+			} else if (high && pool->high_count) {
 				page = ion_page_pool_remove(pool, true);
 			} else if (pool->low_count) {
 				page = ion_page_pool_remove(pool, false);
@@ -239,28 +442,48 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order)
 		return NULL;
 	pool->high_count = 0;
 	pool->low_count = 0;
+	pool->dirty_count = 0;
+	pool->hits = 0;
+	pool->misses = 0;
 	INIT_LIST_HEAD(&pool->low_items);
 	INIT_LIST_HEAD(&pool->high_items);
+	INIT_LIST_HEAD(&pool->dirty_items);
 	pool->gfp_mask = gfp_mask;
 	pool->order = order;
 	mutex_init(&pool->mutex);
 	plist_node_init(&pool->list, order);
+	mutex_lock(&pools_lock);
 	plist_add(&pool->list, &pools);
+	mutex_unlock(&pools_lock);
+	ion_page_pool_wake();
 
 	return pool;
 }
 
+/* once off the list under pools_lock, the pool thread is done with it */
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	mutex_lock(&pools_lock);
 	plist_del(&pool->list, &pools);
+	mutex_unlock(&pools_lock);
 	kfree(pool);
 }
 
 static int __init ion_page_pool_init(void)
 {
+	struct sched_param param = { .sched_priority = 0 };
+
 	shrinker.shrink = ion_page_pool_shrink;
 	shrinker.seeks = DEFAULT_SEEKS;
 	register_shrinker(&shrinker);
+	/* without the thread, dirty pages are zeroed when handed out */
+	pool_task = kthread_run(ion_page_pool_thread, NULL, "ion_page_pool");
+	if (IS_ERR(pool_task)) {
+		pr_err("%s: creating page pool thread failed\n", __func__);
+		pool_task = NULL;
+	} else {
+		sched_setscheduler(pool_task, SCHED_IDLE, &param);
+	}
 #ifdef DEBUG_PAGE_POOL_SHRINKER
 	debugfs_create_file("ion_pools_shrink", 0644, NULL, NULL,
 			    &debug_drop_pools_fops);
@@ -272,6 +495,8 @@ static int __init ion_page_pool_init(void)
 
 static void __exit ion_page_pool_exit(void)
 {
+	if (pool_task)
+		kthread_stop(pool_task);
 	unregister_shrinker(&shrinker);
 }
 
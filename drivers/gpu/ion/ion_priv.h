@@ -249,8 +249,12 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  * struct ion_page_pool - pagepool struct
  * @high_count:		number of highmem items in the pool
  * @low_count:		number of lowmem items in the pool
+ * @dirty_count:	number of freed items not zeroed yet
  * @high_items:		list of highmem items
  * @low_items:		list of lowmem items
+ * @dirty_items:	list of freed items, zeroed by the pool thread
+ * @hits:		allocations served from the pool
+ * @misses:		allocations that fell through to the page allocator
  * @shrinker:		a shrinker for the items
  * @mutex:		lock protecting this struct and especially the count
  *			item list
@@ -270,8 +274,12 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 struct ion_page_pool {
 	int high_count;
 	int low_count;
+	int dirty_count;
 	struct list_head high_items;
 	struct list_head low_items;
+	struct list_head dirty_items;
+	unsigned long hits;
+	unsigned long misses;
 	struct mutex mutex;
 	void *(*alloc)(struct ion_page_pool *pool);
 	void (*free)(struct ion_page_pool *pool, struct page *page);
@@ -214,16 +214,12 @@ void ion_system_heap_free(struct ion_buffer *buffer)
 							struct ion_system_heap,
 							heap);
 	struct sg_table *table = buffer->sg_table;
-	bool cached = ion_buffer_cached(buffer);
 	struct scatterlist *sg;
 	LIST_HEAD(pages);
 	int i;
 
-	/* uncached pages come from the page pools, zero them before returning
-	   for security purposes (other allocations are zerod at alloc time */
-	if (!cached)
-		ion_heap_buffer_zero(buffer);
-
+	/* uncached pages go back to the page pools, which zero them before
+	   handing them out again (other allocations are zeroed at alloc time) */
 	for_each_sg(table->sgl, sg, table->nents, i)
 		free_buffer_page(sys_heap, buffer, sg_page(sg),
 				get_order(sg_dma_len(sg)));
@@ -269,6 +265,10 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 		seq_printf(s, "%d order %u lowmem pages in pool = %lu total\n",
 			   pool->low_count, pool->order,
 			   (1 << pool->order) * PAGE_SIZE * pool->low_count);
+		seq_printf(s, "%d order %u pages waiting to be zeroed\n",
+			   pool->dirty_count, pool->order);
+		seq_printf(s, "order %u pool hits %lu misses %lu\n",
+			   pool->order, pool->hits, pool->misses);
 	}
 	return 0;
 }
@@ -29,6 +29,11 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/types.h>
+#include <linux/rbtree.h>
+#include <asm/sizes.h>
+#include <linux/random.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <linux/io.h>
 #include <linux/uaccess.h>
@@ -42,15 +47,82 @@
 #include "mfc_memory.h"
 
 static struct list_head mfc_alloc_mem_head[MFC_MAX_PORT_NUM];
-static struct list_head mfc_free_mem_head[MFC_MAX_PORT_NUM];
+
+/*
+ * Free memory of each port is kept in two trees: one ordered by address,
+ * used to find the neighbours of a freed chunk so it is merged right
+ * away, and one ordered by size (then address), used for best fit.
+ * Free chunks are never adjacent to each other.
+ */
+static struct rb_root mfc_free_addr_root[MFC_MAX_PORT_NUM];
+static struct rb_root mfc_free_size_root[MFC_MAX_PORT_NUM];
+
+static struct mfc_port_stats mfc_port_stats[MFC_MAX_PORT_NUM];
+static unsigned int mfc_port_size[MFC_MAX_PORT_NUM];
+
+/* protects the lists, trees and stats above */
+static DEFINE_MUTEX(mfc_buffer_lock);
+
+static void mfc_insert_free_mem(struct mfc_free_mem *free_node, int port_no)
+{
+	struct rb_node **p, *parent;
+	struct mfc_free_mem *node;
+
+	p = &mfc_free_addr_root[port_no].rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+		node = rb_entry(parent, struct mfc_free_mem, addr_node);
+		if (free_node->start_addr < node->start_addr)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&free_node->addr_node, parent, p);
+	rb_insert_color(&free_node->addr_node, &mfc_free_addr_root[port_no]);
+
+	p = &mfc_free_size_root[port_no].rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+		node = rb_entry(parent, struct mfc_free_mem, size_node);
+		if (free_node->size < node->size ||
+		    (free_node->size == node->size &&
+		     free_node->start_addr < node->start_addr))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&free_node->size_node, parent, p);
+	rb_insert_color(&free_node->size_node, &mfc_free_size_root[port_no]);
+
+	mfc_port_stats[port_no].free_chunks++;
+}
+
+static void mfc_erase_free_mem(struct mfc_free_mem *free_node, int port_no)
+{
+	rb_erase(&free_node->addr_node, &mfc_free_addr_root[port_no]);
+	rb_erase(&free_node->size_node, &mfc_free_size_root[port_no]);
+	mfc_port_stats[port_no].free_chunks--;
+}
+
+static void mfc_update_largest_free(int port_no)
+{
+	struct rb_node *n = rb_last(&mfc_free_size_root[port_no]);
+
+	mfc_port_stats[port_no].largest_free = n ?
+		rb_entry(n, struct mfc_free_mem, size_node)->size : 0;
+}
 
 void mfc_print_mem_list(void)
 {
 	struct list_head *pos;
+	struct rb_node *n;
 	struct mfc_alloc_mem *alloc_node;
 	struct mfc_free_mem *free_node;
 	int port_no;
 
+	mutex_lock(&mfc_buffer_lock);
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
 		mfc_info("===== %s port%d list =====\n", __func__,  port_no);
 		list_for_each(pos, &mfc_alloc_mem_head[port_no])
@@ -64,87 +136,308 @@ void mfc_print_mem_list(void)
 					alloc_node->size);
 		}
 
-		list_for_each(pos, &mfc_free_mem_head[port_no])
-		{
-			free_node = list_entry(pos, struct mfc_free_mem, list);
+		for (n = rb_first(&mfc_free_addr_root[port_no]); n; n = rb_next(n)) {
+			free_node = rb_entry(n, struct mfc_free_mem, addr_node);
 			mfc_info("[free_list] start_addr: 0x%08x size:%d\n",
 					free_node->start_addr , free_node->size);
 		}
 	}
+	mutex_unlock(&mfc_buffer_lock);
 }
 
-void mfc_merge_fragment(int inst_no)
+void mfc_get_port_stats(int port_no, struct mfc_port_stats *stats)
 {
-	struct list_head *pos, *n;
-	struct mfc_free_mem *node1, *node2;
-	int port_no;
-
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_free_mem_head[port_no])
-		{
-			node1 = list_entry(pos, struct mfc_free_mem, list);
-			node2 = list_entry(n, struct mfc_free_mem, list);
-			if ((node1->start_addr + node1->size) == node2->start_addr) {
-				node2->start_addr = node1->start_addr;
-				node2->size += node1->size;
-				list_del(&(node1->list));
-				kfree(node1);
-			}
-		}
-	}
+	mutex_lock(&mfc_buffer_lock);
+	*stats = mfc_port_stats[port_no];
+	mutex_unlock(&mfc_buffer_lock);
+}
 
+/*
+ * Free chunks are merged as soon as they are freed, so there is nothing
+ * left to do here; kept for the callers in mfc.c.
+ */
+void mfc_merge_fragment(int inst_no)
+{
 #if defined(DEBUG)
 	mfc_print_mem_list();
 #endif
 }
 
-
-
+/* best fit: the smallest free chunk that is large enough, lowest first */
 static unsigned int mfc_get_free_mem(int alloc_size, int inst_no, int port_no)
 {
-	struct list_head *pos;
+	struct rb_node *n = mfc_free_size_root[port_no].rb_node;
 	struct mfc_free_mem *free_node, *match_node = NULL;
-	unsigned int alloc_addr = 0;
+	unsigned int alloc_addr;
 
 	mfc_debug("request Size : %d\n", alloc_size);
 
-	if (list_empty(&mfc_free_mem_head[port_no])) {
-		mfc_err("all memory is gone\n");
-		return alloc_addr;
-	}
-	/* find best chunk of memory */
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		free_node = list_entry(pos, struct mfc_free_mem, list);
-
-		if (match_node != NULL) {
-			if ((free_node->size >= alloc_size) &&
-				(free_node->size < match_node->size))
-				match_node = free_node;
+	if (alloc_size <= 0)
+		return 0;
+
+	while (n) {
+		free_node = rb_entry(n, struct mfc_free_mem, size_node);
+		if (free_node->size >= alloc_size) {
+			match_node = free_node;
+			n = n->rb_left;
 		} else {
-			if (free_node->size >= alloc_size)
-				match_node = free_node;
+			n = n->rb_right;
 		}
 	}
 
+	if (match_node == NULL) {
+		mfc_port_stats[port_no].alloc_fail++;
+		mfc_err("there is no suitable chunk: port%d size %d, "
+			"free %u in %u chunks, largest %u\n", port_no,
+			alloc_size, mfc_port_stats[port_no].free_size,
+			mfc_port_stats[port_no].free_chunks,
+			mfc_port_stats[port_no].largest_free);
+		return 0;
+	}
 
-	if (match_node != NULL) {
-		mfc_debug("match : startAddr(0x%08x) size(%d)\n", match_node->start_addr, match_node->size);
+	mfc_debug("match : startAddr(0x%08x) size(%d)\n", match_node->start_addr, match_node->size);
 
-		alloc_addr = match_node->start_addr;
+	alloc_addr = match_node->start_addr;
+	mfc_erase_free_mem(match_node, port_no);
+	if (match_node->size == alloc_size) {
+		kfree(match_node);
+	} else {
 		match_node->start_addr += alloc_size;
 		match_node->size -= alloc_size;
-
-		if (match_node->size < 0x1)	/* delete match_node. */
-			mfc_err("there is no suitable chunk...[case 0]\n");
-	} else {
-		mfc_err("there is no suitable chunk....[case 1]\n");
-		return 0;
+		mfc_insert_free_mem(match_node, port_no);
 	}
 
+	mfc_port_stats[port_no].free_size -= alloc_size;
+	mfc_port_stats[port_no].alloc_count++;
+	mfc_update_largest_free(port_no);
+
 	return alloc_addr;
 }
 
+/*
+ * Return an allocation to the free trees, merging it with the free chunks
+ * right before and after it. Caller must hold mfc_buffer_lock.
+ */
+void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
+{
+	struct rb_node *n = mfc_free_addr_root[port_no].rb_node;
+	struct mfc_free_mem *node, *prev = NULL, *next = NULL;
+	struct mfc_free_mem *free_node = alloc_node->spare;
+	unsigned int start_addr = alloc_node->p_addr;
+	unsigned int size = alloc_node->size;
+
+	while (n) {
+		node = rb_entry(n, struct mfc_free_mem, addr_node);
+		if (node->start_addr < start_addr) {
+			prev = node;
+			n = n->rb_right;
+		} else {
+			next = node;
+			n = n->rb_left;
+		}
+	}
+
+	if (prev && prev->start_addr + prev->size == start_addr) {
+		mfc_erase_free_mem(prev, port_no);
+		start_addr = prev->start_addr;
+		size += prev->size;
+		kfree(free_node);
+		free_node = prev;
+	}
+	if (next && start_addr + size == next->start_addr) {
+		mfc_erase_free_mem(next, port_no);
+		size += next->size;
+		kfree(next);
+	}
+
+	free_node->start_addr = start_addr;
+	free_node->size = size;
+	mfc_insert_free_mem(free_node, port_no);
+
+	mfc_port_stats[port_no].free_size += alloc_node->size;
+	mfc_port_stats[port_no].alloc_count--;
+	mfc_update_largest_free(port_no);
+
+	list_del(&(alloc_node->list));
+	kfree(alloc_node);
+}
+
+/*
+ * Carve 'size' bytes out of the port for instance 'inst_no'. The free
+ * chunk needed to give them back is allocated here, so that freeing can
+ * not fail. Caller must hold mfc_buffer_lock.
+ */
+static struct mfc_alloc_mem *mfc_alloc_mem_node(int size, int inst_no,
+						int port_no)
+{
+	struct mfc_alloc_mem *alloc_node;
+
+	alloc_node = kzalloc(sizeof(struct mfc_alloc_mem), GFP_KERNEL);
+	if (!alloc_node)
+		return NULL;
+	alloc_node->spare = kzalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
+	if (!alloc_node->spare)
+		goto err_spare;
+
+	alloc_node->p_addr = mfc_get_free_mem(size, inst_no, port_no);
+	if (!alloc_node->p_addr)
+		goto err_free_mem;
+
+	alloc_node->size = size;
+	alloc_node->inst_no = inst_no;
+	list_add(&(alloc_node->list), &mfc_alloc_mem_head[port_no]);
+	return alloc_node;
+
+err_free_mem:
+	kfree(alloc_node->spare);
+err_spare:
+	kfree(alloc_node);
+	return NULL;
+}
+
+static void mfc_release_all_buffer_locked(int inst_no)
+{
+	struct list_head *pos, *n;
+	int port_no;
+	struct mfc_alloc_mem *alloc_node;
+
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		list_for_each_safe(pos, n, &mfc_alloc_mem_head[port_no]) {
+			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
+			if (alloc_node->inst_no == inst_no) {
+				mfc_free_alloc_mem(alloc_node, port_no);
+			}
+		}
+	}
+}
+
+static int mfc_buffer_stats_show(struct seq_file *s, void *unused)
+{
+	struct mfc_port_stats stats;
+	int port_no;
+
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		mfc_get_port_stats(port_no, &stats);
+		seq_printf(s, "port%d: size %u free %u chunks %u largest %u "
+			   "fragmentation %u%% allocs %u failed %u\n",
+			   port_no, mfc_port_size[port_no], stats.free_size,
+			   stats.free_chunks, stats.largest_free,
+			   stats.free_size ? 100 - (unsigned int)
+				((u64)stats.largest_free * 100 /
+				 stats.free_size) : 0,
+			   stats.alloc_count, stats.alloc_fail);
+	}
+	return 0;
+}
+
+static int mfc_buffer_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mfc_buffer_stats_show, NULL);
+}
+
+static const struct file_operations mfc_buffer_stats_fops = {
+	.open = mfc_buffer_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+#ifdef CONFIG_VIDEO_MFC50_ALLOC_SELFTEST
+/*
+ * Check that the free chunks of a port are address ordered, do not
+ * overlap and were all merged with their neighbours, and that the stats
+ * agree with the trees.
+ */
+static int mfc_check_free_mem(int port_no)
+{
+	struct rb_node *n;
+	struct mfc_free_mem *node, *prev = NULL;
+	unsigned int free_size = 0, chunks = 0;
+
+	for (n = rb_first(&mfc_free_addr_root[port_no]); n; n = rb_next(n)) {
+		node = rb_entry(n, struct mfc_free_mem, addr_node);
+		if (prev && prev->start_addr + prev->size >= node->start_addr) {
+			mfc_err("port%d: free chunks 0x%08x+%u and 0x%08x "
+				"overlap or were not merged\n", port_no,
+				prev->start_addr, prev->size,
+				node->start_addr);
+			return -EINVAL;
+		}
+		free_size += node->size;
+		chunks++;
+		prev = node;
+	}
+
+	if (free_size != mfc_port_stats[port_no].free_size ||
+	    chunks != mfc_port_stats[port_no].free_chunks) {
+		mfc_err("port%d: stats say %u bytes in %u chunks, trees %u "
+			"in %u\n", port_no, mfc_port_stats[port_no].free_size,
+			mfc_port_stats[port_no].free_chunks, free_size, chunks);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+#define MFC_SELFTEST_ROUNDS	500
+#define MFC_SELFTEST_INSTANCES	4
+#define MFC_SELFTEST_BUFFERS	8
+
+/*
+ * Replay random codec open/close sequences against the real port memory
+ * before the device is registered: each round either opens an instance,
+ * which allocates a few buffers of typical sizes, or closes one. Once all
+ * instances are closed every port must be back to a single free chunk.
+ */
+static void mfc_buffer_selftest(void)
+{
+	static const unsigned int sizes[] = {
+		SZ_4K, 3 * SZ_4K, SZ_64K, 152 * SZ_1K, 600 * SZ_1K, SZ_1M,
+		1555 * SZ_1K, 3 * SZ_1M,
+	};
+	bool open[MFC_SELFTEST_INSTANCES] = { 0 };
+	int round, inst_no, port_no, i, failed = 0, errors = 0;
+
+	mutex_lock(&mfc_buffer_lock);
+	for (round = 0; round < MFC_SELFTEST_ROUNDS && !errors; round++) {
+		inst_no = random32() % MFC_SELFTEST_INSTANCES;
+		if (open[inst_no]) {
+			mfc_release_all_buffer_locked(inst_no);
+			open[inst_no] = false;
+		} else {
+			for (i = 0; i < MFC_SELFTEST_BUFFERS; i++) {
+				port_no = random32() % MFC_MAX_PORT_NUM;
+				if (!mfc_alloc_mem_node(sizes[random32() %
+						ARRAY_SIZE(sizes)] +
+						(random32() % 4) * SZ_4K,
+						inst_no, port_no))
+					failed++;
+			}
+			open[inst_no] = true;
+		}
+		for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++)
+			if (mfc_check_free_mem(port_no))
+				errors++;
+	}
+
+	for (inst_no = 0; inst_no < MFC_SELFTEST_INSTANCES; inst_no++)
+		mfc_release_all_buffer_locked(inst_no);
+
+	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
+		if (mfc_check_free_mem(port_no) ||
+		    mfc_port_stats[port_no].free_chunks != 1 ||
+		    mfc_port_stats[port_no].free_size != mfc_port_size[port_no]) {
+			mfc_err("port%d: memory not fully merged back\n",
+				port_no);
+			errors++;
+		}
+		mfc_port_stats[port_no].alloc_fail = 0;
+	}
+	mutex_unlock(&mfc_buffer_lock);
+
+	mfc_info("buffer manager selftest: %d rounds, %d failed allocations, "
+		 "%s\n", round, failed, errors ? "FAILED" : "passed");
+}
+#endif
 
 int mfc_init_buffer(void)
 {
@@ -153,11 +446,14 @@ int mfc_init_buffer(void)
 
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
 		INIT_LIST_HEAD(&mfc_alloc_mem_head[port_no]);
-		INIT_LIST_HEAD(&mfc_free_mem_head[port_no]);
+		mfc_free_addr_root[port_no] = RB_ROOT;
+		mfc_free_size_root[port_no] = RB_ROOT;
+		memset(&mfc_port_stats[port_no], 0,
+		       sizeof(struct mfc_port_stats));
 		/* init free head node */
-		free_node =
-			(struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-		memset(free_node, 0x00, sizeof(struct mfc_free_mem));
+		free_node = kzalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
+		if (!free_node)
+			return -ENOMEM;
 
 		if (port_no) {
 			free_node->start_addr = mfc_get_port1_buff_paddr();
@@ -168,9 +464,18 @@ int mfc_init_buffer(void)
 				(mfc_get_port0_buff_paddr() - mfc_get_fw_buff_paddr());
 		}
 
-		list_add_tail(&(free_node->list), &mfc_free_mem_head[port_no]);
+		mfc_port_size[port_no] = free_node->size;
+		mfc_port_stats[port_no].free_size = free_node->size;
+		mfc_insert_free_mem(free_node, port_no);
+		mfc_update_largest_free(port_no);
 	}
 
+#ifdef CONFIG_VIDEO_MFC50_ALLOC_SELFTEST
+	mfc_buffer_selftest();
+#endif
+	debugfs_create_file("mfc_buffers", S_IRUGO, NULL, NULL,
+			    &mfc_buffer_stats_fops);
+
 #if defined(DEBUG)
 	mfc_print_mem_list();
 #endif
@@ -184,6 +489,7 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 	struct mfc_alloc_mem *alloc_node;
 	bool found = false;
 
+	mutex_lock(&mfc_buffer_lock);
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
 		list_for_each(pos, &mfc_alloc_mem_head[port_no])
 		{
@@ -194,7 +500,10 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 				break;
 			}
 		}
+		if (found)
+			break;
 	}
+	mutex_unlock(&mfc_buffer_lock);
 
 #if defined(DEBUG)
 	mfc_print_mem_list();
@@ -208,50 +517,15 @@ enum mfc_error_code mfc_release_buffer(unsigned char *u_addr)
 
 void mfc_release_all_buffer(int inst_no)
 {
-	struct list_head *pos, *n;
-	int port_no;
-	struct mfc_alloc_mem *alloc_node;
-
-	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
-		list_for_each_safe(pos, n, &mfc_alloc_mem_head[port_no]) {
-			alloc_node = list_entry(pos, struct mfc_alloc_mem, list);
-			if (alloc_node->inst_no == inst_no) {
-				mfc_free_alloc_mem(alloc_node, port_no);
-			}
-		}
-	}
+	mutex_lock(&mfc_buffer_lock);
+	mfc_release_all_buffer_locked(inst_no);
+	mutex_unlock(&mfc_buffer_lock);
 
 #if defined(DEBUG)
 	mfc_print_mem_list();
 #endif
 }
 
-void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no)
-{
-	struct list_head *pos;
-	struct mfc_free_mem *free_node;
-	struct mfc_free_mem *target_node;
-
-	free_node = (struct mfc_free_mem *)kmalloc(sizeof(struct mfc_free_mem), GFP_KERNEL);
-	free_node->start_addr = alloc_node->p_addr;
-	free_node->size = alloc_node->size;
-
-	list_for_each(pos, &mfc_free_mem_head[port_no])
-	{
-		target_node = list_entry(pos, struct mfc_free_mem, list);
-		if (alloc_node->p_addr < target_node->start_addr)
-			break;
-	}
-
-	if (pos == &mfc_free_mem_head[port_no])
-		list_add_tail(&(free_node->list), &(mfc_free_mem_head[port_no]));
-	else
-		list_add_tail(&(free_node->list), pos);
-
-	list_del(&(alloc_node->list));
-	kfree(alloc_node);
-}
-
 enum mfc_error_code mfc_get_phys_addr(struct mfc_inst_ctx *mfc_ctx, union mfc_args *args)
 {
 	int ret, port_no;
@@ -260,6 +534,7 @@ enum mfc_error_code mfc_get_phys_addr(struct mfc_inst_ctx *mfc_ctx, union mfc_ar
 	struct mfc_get_phys_addr_arg *phys_addr_arg;
 
 	phys_addr_arg = (struct mfc_get_phys_addr_arg *)args;
+	mutex_lock(&mfc_buffer_lock);
 	for (port_no = 0; port_no < MFC_MAX_PORT_NUM; port_no++) {
 		list_for_each(pos, &mfc_alloc_mem_head[port_no])
 		{
@@ -281,6 +556,7 @@ found:
 	ret = MFCINST_RET_OK;
 
 out_getphysaddr:
+	mutex_unlock(&mfc_buffer_lock);
 	return ret;
 }
 
@@ -288,33 +564,23 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 {
 	int ret;
 	int inst_no = mfc_ctx->mem_inst_no;
-	unsigned int start_paddr;
 	struct mfc_mem_alloc_arg *in_param;
 	struct mfc_alloc_mem *alloc_node;
 
 	in_param = (struct mfc_mem_alloc_arg *)args;
 
-	alloc_node = (struct mfc_alloc_mem *)kmalloc(sizeof(struct mfc_alloc_mem), GFP_KERNEL);
-	if (!alloc_node) {
-		mfc_err("There is no more kernel memory");
-		ret = MFCINST_MEMORY_ALLOC_FAIL;
-		goto out_getcodecviraddr;
-	}
-	memset(alloc_node, 0x00, sizeof(struct mfc_alloc_mem));
-
 	/* if user request area, allocate from reserved area */
-	start_paddr = mfc_get_free_mem((int)in_param->buff_size, inst_no, port_no);
-	mfc_debug("start_paddr = 0x%X\n\r", start_paddr);
-
-	if (!start_paddr) {
+	mutex_lock(&mfc_buffer_lock);
+	alloc_node = mfc_alloc_mem_node((int)in_param->buff_size, inst_no, port_no);
+	if (!alloc_node) {
+		mutex_unlock(&mfc_buffer_lock);
 		mfc_err("There is no more memory\n\r");
 		in_param->out_uaddr = -1;
 		ret = MFCINST_MEMORY_ALLOC_FAIL;
-		kfree(alloc_node);
 		goto out_getcodecviraddr;
 	}
+	mfc_debug("start_paddr = 0x%X\n\r", alloc_node->p_addr);
 
-	alloc_node->p_addr = start_paddr;
 	if (port_no) {
 		alloc_node->v_addr = (unsigned char *)(mfc_get_port1_buff_vaddr() +
 			(alloc_node->p_addr - mfc_get_port1_buff_paddr()));
@@ -327,6 +593,7 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 		alloc_node->u_addr = (unsigned char *)(in_param->mapped_addr +
 			(alloc_node->p_addr - mfc_get_port0_buff_paddr()));
 	}
+	mutex_unlock(&mfc_buffer_lock);
 
 	in_param->out_uaddr = (unsigned int)alloc_node->u_addr;
 	in_param->out_paddr = (unsigned int)alloc_node->p_addr;
@@ -335,10 +602,6 @@ enum mfc_error_code mfc_allocate_buffer(struct mfc_inst_ctx *mfc_ctx, union mfc_
 			(unsigned int)alloc_node->v_addr,
 			alloc_node->p_addr);
 
-	alloc_node->size = (int)in_param->buff_size;
-	alloc_node->inst_no = inst_no;
-
-	list_add(&(alloc_node->list), &mfc_alloc_mem_head[port_no]);
 	ret = MFCINST_RET_OK;
 
 #if defined(DEBUG)
@@ -20,6 +20,7 @@
 #define _MFC_BUFFER_MANAGER_H_
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include "mfc_interface.h"
 #include "mfc_opr.h"
 
@@ -33,20 +34,30 @@ struct mfc_alloc_mem  {
 	unsigned char *u_addr;     /* virtual address for user mode process */
 	int size;                  /* memory size                           */
 	int inst_no;               /* instance no                           */
+	struct mfc_free_mem *spare; /* free node used when this is released */
 };
 
 
 struct mfc_free_mem  {
-	struct list_head list;     /* struct list_head for free mem         */
+	struct rb_node addr_node;  /* node in the address ordered tree      */
+	struct rb_node size_node;  /* node in the size ordered tree         */
 	unsigned int start_addr;   /* start address of free mem             */
 	unsigned int size;         /* size of free mem                      */
 };
 
+struct mfc_port_stats {
+	unsigned int free_size;    /* total free bytes                      */
+	unsigned int largest_free; /* largest free chunk                    */
+	unsigned int free_chunks;  /* number of free chunks                 */
+	unsigned int alloc_count;  /* live allocations                      */
+	unsigned int alloc_fail;   /* allocations that found no chunk       */
+};
 
 /* Function Prototype */
 void mfc_print_mem_list(void);
 int mfc_init_buffer(void);
 void mfc_merge_fragment(int inst_no);
+void mfc_get_port_stats(int port_no, struct mfc_port_stats *stats);
 void mfc_release_all_buffer(int inst_no);
 void mfc_free_alloc_mem(struct mfc_alloc_mem *alloc_node, int port_no);
 enum mfc_error_code mfc_release_buffer(unsigned char *u_addr);
@@ -37,6 +37,9 @@
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include "onedram.h"
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+#include "onedram_emu.h"
+#endif
 
 #define DRVNAME "onedram"
 
@@ -166,6 +169,9 @@ static inline int _send_cmd(struct onedram *od, u32 cmd)
 	dev_dbg(od->dev, "send %x\n", cmd);
 	send_cnt++;
 	od->reg->mailbox_BA = cmd;
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+	onedram_emu_recv(cmd);
+#endif
 	return 0;
 }
 
@@ -399,6 +405,23 @@ static irqreturn_t onedram_irq_handler(int irq, void *data)
 	return IRQ_HANDLED;
 }
 
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+/* the emulated modem writes its mailbox and interrupts the AP */
+static void _emu_raise(u32 mailbox)
+{
+	unsigned long flags;
+
+	if (!onedram || !onedram->reg)
+		return;
+
+	onedram->reg->mailbox_AB = mailbox;
+
+	local_irq_save(flags);
+	onedram_irq_handler(0, onedram);
+	local_irq_restore(flags);
+}
+#endif
+
 static void onedram_vm_close(struct vm_area_struct *vma)
 {
 	struct onedram *od = vma->vm_private_data;
@@ -537,6 +560,11 @@ static int onedram_mmap(struct file *filp, struct vm_area_struct *vma)
 	if (!od || !vma)
 		return -EFAULT;
 
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+	/* the emulated OneDRAM is not physically contiguous */
+	return -ENODEV;
+#endif
+
 	atomic_inc(&od->ref_sem);
 	if (!_read_sem(od)) {
 		atomic_dec(&od->ref_sem);
@@ -644,8 +672,17 @@ static int _register_chrdev(struct onedram *od)
 
 static inline int _request_mem(struct onedram *od, struct platform_device *pdev)
 {
+#ifndef CONFIG_SAMSUNG_ONEDRAM_EMU
 	struct resource *reso;
+#endif
 
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+	od->mmio = onedram_emu_map(od->size);
+	if (!od->mmio) {
+		dev_err(&pdev->dev, "Failed to allocate emulated OneDRAM\n");
+		return -ENOMEM;
+	}
+#else
 	reso = request_mem_region(od->base, od->size, DRVNAME);
 	if (!reso) {
 		dev_err(&pdev->dev, "Failed to request the mem region:"
@@ -660,6 +697,7 @@ static inline int _request_mem(struct onedram *od, struct platform_device *pdev)
 				od->base, od->size);
 		return -EBUSY;
 	}
+#endif
 
 	od->reg = (struct onedram_reg_mapped *)(
 			(char *)od->mmio + ONEDRAM_REG_OFFSET);
@@ -692,8 +730,12 @@ static void _release(struct onedram *od)
 
 	if (od->mmio) {
 		od->reg = NULL;
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+		onedram_emu_unmap(od->mmio);
+#else
 		iounmap(od->mmio);
 		release_mem_region(od->base, od->size);
+#endif
 		onedram_resource.start = 0;
 		onedram_resource.end = -1;
 	}
@@ -853,6 +895,7 @@ static int __devinit onedram_probe(struct platform_device *pdev)
 
 	_init_data(od);
 
+#ifndef CONFIG_SAMSUNG_ONEDRAM_EMU
 	pdata->cfg_gpio();
 
 	r = request_irq(irq, onedram_irq_handler,
@@ -864,6 +907,7 @@ static int __devinit onedram_probe(struct platform_device *pdev)
 	}
 	od->irq = irq;
 	enable_irq_wake(od->irq);
+#endif
 
 	r = _register_chrdev(od);
 	if (r) {
@@ -878,6 +922,14 @@ static int __devinit onedram_probe(struct platform_device *pdev)
 	}
 	od->group = &onedram_group;
 
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+	r = onedram_emu_init(od->dev, od->mmio, &od->reg->sem, _emu_raise);
+	if (r) {
+		dev_err(&pdev->dev, "Failed to start the emulator\n");
+		goto err;
+	}
+#endif
+
 	platform_set_drvdata(pdev, od);
 
 	return 0;
@@ -892,6 +944,9 @@ static int __devexit onedram_remove(struct platform_device *pdev)
 	struct onedram *od = platform_get_drvdata(pdev);
 
 	/* TODO: need onedram_resource clean? */
+#ifdef CONFIG_SAMSUNG_ONEDRAM_EMU
+	onedram_emu_exit(od->dev);
+#endif
 	_unregister_all_handlers();
 	platform_set_drvdata(pdev, NULL);
 	onedram = NULL;
@@ -0,0 +1,376 @@
+/**
+ * Software OneDRAM emulator
+ *
+ * Plays the modem side of the OneDRAM so that the SIPC4/svnet data path
+ * can be exercised and benchmarked on a board without a modem.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+//#define DEBUG
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/spinlock.h>
+#include <linux/circ_buf.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/io.h>
+
+#include "onedram_emu.h"
+#include "../svnet/sipc4.h"
+
+#define EMU_DEFAULT_BATCH 16
+#define EMU_ACK_TIMEOUT HZ
+#define EMU_DRAIN_TIMEOUT 1000 /* ms */
+
+struct onedram_emu {
+	struct device *dev;
+	unsigned char *base;
+	struct sipc_mapped *map;
+	u32 *sem;
+	void (*raise)(u32 mailbox);
+
+	struct workqueue_struct *wq;
+
+	/* mailbox values written by the AP, handled in work_cmd */
+	spinlock_t lock;
+	u32 mailbox;
+	int req_sem;
+	struct work_struct work_cmd;
+
+	/* RX generator */
+	struct work_struct work_gen;
+	struct completion ack;
+	int chid;
+	unsigned int count;
+	unsigned int size;
+	unsigned int batch;
+	int running;
+	unsigned char *payload;
+
+	/* statistics */
+	unsigned long rx_frames;
+	unsigned long long rx_bytes;
+	unsigned long rx_mailbox;
+	unsigned long rx_full;
+	s64 rx_time_us;
+	unsigned long long tx_bytes;
+	unsigned long tx_mailbox;
+};
+static struct onedram_emu *emu;
+
+void __iomem *onedram_emu_map(unsigned long size)
+{
+	void *base;
+
+	base = vmalloc(size);
+	if (!base)
+		return NULL;
+
+	memset(base, 0, size);
+
+	return (void __iomem *)base;
+}
+
+void onedram_emu_unmap(void __iomem *base)
+{
+	vfree((void __force *)base);
+}
+
+void onedram_emu_recv(u32 mailbox)
+{
+	unsigned long flags;
+	u32 cmd;
+
+	if (!emu || !(mailbox & MB_VALID))
+		return;
+
+	spin_lock_irqsave(&emu->lock, flags);
+	if (mailbox & MB_COMMAND) {
+		cmd = (mailbox & MBC_MASK) & ~(MB_CMD(0));
+		if (cmd == MBC_REQ_SEM)
+			emu->req_sem = 1;
+	} else {
+		emu->mailbox |= mailbox;
+	}
+	spin_unlock_irqrestore(&emu->lock, flags);
+
+	queue_work(emu->wq, &emu->work_cmd);
+}
+
+static void _consume_out(struct onedram_emu *e, int idx, unsigned int size)
+{
+	struct ringbuf_cont *rc = &e->map->rbcont[idx];
+
+	e->tx_bytes += CIRC_CNT(rc->out_head, rc->out_tail, size);
+	rc->out_tail = rc->out_head;
+}
+
+static void emu_cmd_work(struct work_struct *work)
+{
+	struct onedram_emu *e = container_of(work,
+			struct onedram_emu, work_cmd);
+	u32 mailbox;
+	int req_sem;
+
+	spin_lock_irq(&e->lock);
+	mailbox = e->mailbox;
+	e->mailbox = 0;
+	req_sem = e->req_sem;
+	e->req_sem = 0;
+	spin_unlock_irq(&e->lock);
+
+	/* the modem never holds the semaphore, hand it over at once */
+	if (req_sem) {
+		*e->sem = 1;
+		e->raise(MB_CMD(MBC_RES_SEM));
+	}
+
+	if (mailbox & (MBD_SEND_FMT | MBD_SEND_RAW | MBD_SEND_RFS))
+		e->tx_mailbox++;
+	if (mailbox & MBD_SEND_FMT)
+		_consume_out(e, IPCIDX_FMT, FMT_SZ);
+	if (mailbox & MBD_SEND_RAW)
+		_consume_out(e, IPCIDX_RAW, RAW_SZ);
+	if (mailbox & MBD_SEND_RFS)
+		_consume_out(e, IPCIDX_RFS, RFS_SZ);
+
+	if (mailbox & MBD_RES_ACK_RAW)
+		complete(&e->ack);
+}
+
+static u32 _put(unsigned char *in, u32 head, const void *buf,
+		unsigned int len)
+{
+	unsigned int c;
+
+	while (len) {
+		c = min(len, RAW_SZ - head);
+		memcpy(in + head, buf, c);
+		head = (head + c) & (RAW_SZ - 1);
+		buf += c;
+		len -= c;
+	}
+
+	return head;
+}
+
+static void _write_frame(struct onedram_emu *e)
+{
+	struct ringbuf_cont *rc = &e->map->rbcont[IPCIDX_RAW];
+	unsigned char *in = e->base + RAW_IN;
+	unsigned char hdlc;
+	struct raw_hdr h;
+	u32 head = rc->in_head;
+
+	h.len = sizeof(h) + e->size;
+	h.channel = e->chid;
+	h.control = 0;
+
+	hdlc = HDLC_START;
+	head = _put(in, head, &hdlc, sizeof(hdlc));
+	head = _put(in, head, &h, sizeof(h));
+	head = _put(in, head, e->payload, e->size);
+	hdlc = HDLC_END;
+	head = _put(in, head, &hdlc, sizeof(hdlc));
+
+	/* the AP may be reading the ring: publish the frame last */
+	smp_wmb();
+	rc->in_head = head;
+}
+
+static void emu_gen_work(struct work_struct *work)
+{
+	struct onedram_emu *e = container_of(work,
+			struct onedram_emu, work_gen);
+	struct ringbuf_cont *rc = &e->map->rbcont[IPCIDX_RAW];
+	unsigned int frame_len = 2 + sizeof(struct raw_hdr) + e->size;
+	unsigned int i, pending = 0;
+	int wait;
+	ktime_t start;
+
+	e->rx_frames = 0;
+	e->rx_bytes = 0;
+	e->rx_mailbox = 0;
+	e->rx_full = 0;
+
+	start = ktime_get();
+	for (i = 0; i < e->count && e->running; i++) {
+		while (CIRC_SPACE(rc->in_head, rc->in_tail, RAW_SZ)
+				< frame_len) {
+			/* ring full: ask for an acknowledge as the modem does */
+			e->rx_full++;
+			INIT_COMPLETION(e->ack);
+			e->raise(MB_DATA(MBD_SEND_RAW | MBD_REQ_ACK_RAW));
+			e->rx_mailbox++;
+			pending = 0;
+			if (!wait_for_completion_timeout(&e->ack,
+						EMU_ACK_TIMEOUT)) {
+				dev_err(e->dev, "emu: no ack, ring stuck\n");
+				goto out;
+			}
+		}
+
+		_write_frame(e);
+		e->rx_frames++;
+		e->rx_bytes += e->size;
+
+		if (++pending >= e->batch) {
+			e->raise(MB_DATA(MBD_SEND_RAW));
+			e->rx_mailbox++;
+			pending = 0;
+		}
+	}
+
+	if (pending) {
+		e->raise(MB_DATA(MBD_SEND_RAW));
+		e->rx_mailbox++;
+	}
+
+	/* time until the AP has taken everything out of the ring */
+	for (wait = 0; wait < EMU_DRAIN_TIMEOUT; wait++) {
+		if (rc->in_tail == rc->in_head)
+			break;
+		msleep(1);
+	}
+
+out:
+	e->rx_time_us = ktime_us_delta(ktime_get(), start);
+	e->running = 0;
+}
+
+static ssize_t show_emu_rx(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	char *p = buf;
+	u64 kbps = 0;
+
+	if (!emu)
+		return 0;
+
+	if (emu->rx_time_us > 0)
+		kbps = div64_u64(emu->rx_bytes * 8 * 1000, emu->rx_time_us);
+
+	p += sprintf(p, "%s\n", emu->running ? "running" : "idle");
+	p += sprintf(p, "RX frames: %lu\n", emu->rx_frames);
+	p += sprintf(p, "RX bytes: %llu\n", emu->rx_bytes);
+	p += sprintf(p, "RX mailbox: %lu\n", emu->rx_mailbox);
+	p += sprintf(p, "RX ring full: %lu\n", emu->rx_full);
+	p += sprintf(p, "RX time: %lld us (%llu kbit/s)\n",
+			emu->rx_time_us, kbps);
+	p += sprintf(p, "TX bytes: %llu\n", emu->tx_bytes);
+	p += sprintf(p, "TX mailbox: %lu\n", emu->tx_mailbox);
+
+	return p - buf;
+}
+
+/* "<channel> <count> <size> [<frames per mailbox>]" */
+static ssize_t store_emu_rx(struct device *d,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int chid, n, size, batch = EMU_DEFAULT_BATCH;
+	unsigned char *payload;
+	int r;
+
+	if (!emu)
+		return -ENODEV;
+
+	r = sscanf(buf, "%u %u %u %u", &chid, &n, &size, &batch);
+	if (r < 3 || chid >= CHID_MAX || !size || size > RAW_SZ / 2 || !batch)
+		return -EINVAL;
+
+	if (emu->running)
+		return -EBUSY;
+
+	flush_work(&emu->work_gen);
+
+	payload = krealloc(emu->payload, size, GFP_KERNEL);
+	if (!payload)
+		return -ENOMEM;
+	memset(payload, 0x5a, size);
+	emu->payload = payload;
+
+	emu->chid = chid;
+	emu->count = n;
+	emu->size = size;
+	emu->batch = batch;
+	emu->running = 1;
+	queue_work(emu->wq, &emu->work_gen);
+
+	return count;
+}
+
+static DEVICE_ATTR(emu_rx, 0664, show_emu_rx, store_emu_rx);
+
+int onedram_emu_init(struct device *dev, void __iomem *base,
+		u32 *sem, void (*raise)(u32 mailbox))
+{
+	struct onedram_emu *e;
+	int r;
+
+	e = kzalloc(sizeof(struct onedram_emu), GFP_KERNEL);
+	if (!e)
+		return -ENOMEM;
+
+	e->wq = create_singlethread_workqueue("onedram_emu");
+	if (!e->wq) {
+		kfree(e);
+		return -ENOMEM;
+	}
+
+	e->dev = dev;
+	e->base = (unsigned char __force *)base;
+	e->map = (struct sipc_mapped *)e->base;
+	e->sem = sem;
+	e->raise = raise;
+	spin_lock_init(&e->lock);
+	INIT_WORK(&e->work_cmd, emu_cmd_work);
+	INIT_WORK(&e->work_gen, emu_gen_work);
+	init_completion(&e->ack);
+
+	r = device_create_file(dev, &dev_attr_emu_rx);
+	if (r) {
+		destroy_workqueue(e->wq);
+		kfree(e);
+		return r;
+	}
+
+	/* the AP owns the memory from the start */
+	*e->sem = 1;
+	emu = e;
+
+	dev_info(dev, "OneDRAM emulator enabled\n");
+
+	return 0;
+}
+
+void onedram_emu_exit(struct device *dev)
+{
+	struct onedram_emu *e = emu;
+
+	if (!e)
+		return;
+
+	device_remove_file(dev, &dev_attr_emu_rx);
+
+	e->running = 0;
+	complete(&e->ack);
+	emu = NULL;
+	destroy_workqueue(e->wq);
+
+	kfree(e->payload);
+	kfree(e);
+}
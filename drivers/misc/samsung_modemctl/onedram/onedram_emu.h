@@ -0,0 +1,36 @@
+/**
+ * Software OneDRAM emulator, the modem side of the shared memory
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __ONEDRAM_EMU_H__
+#define __ONEDRAM_EMU_H__
+
+#include <linux/device.h>
+#include <linux/types.h>
+
+/*
+ * The emulator backs the OneDRAM window with vmalloc memory and plays
+ * the modem: it grants the semaphore, consumes the OUT rings and fills
+ * the RAW IN ring on request. Interrupts are delivered by calling
+ * 'raise' with the mailbox value the modem would have written.
+ */
+extern void __iomem *onedram_emu_map(unsigned long size);
+extern void onedram_emu_unmap(void __iomem *base);
+
+extern int onedram_emu_init(struct device *dev, void __iomem *base,
+		u32 *sem, void (*raise)(u32 mailbox));
+extern void onedram_emu_exit(struct device *dev);
+
+/* a mailbox value written by the AP */
+extern void onedram_emu_recv(u32 mailbox);
+
+#endif /* __ONEDRAM_EMU_H__ */
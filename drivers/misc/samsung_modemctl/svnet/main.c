@@ -29,6 +29,7 @@
 #include <linux/workqueue.h>
 #include <linux/list.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
 
 #include <linux/netdevice.h>
 #include <linux/skbuff.h>
@@ -73,26 +74,23 @@ struct svnet_stat {
 	unsigned long st_do_write;
 	unsigned long st_do_read;
 	unsigned long st_do_rx;
+	unsigned long st_rx_masked;
+	unsigned long st_rx_budget;
+	unsigned long st_tx_deadline;
+	unsigned long st_tx_budget;
 };
 static struct svnet_stat stat;
 
-struct svnet_evt {
-	struct list_head list;
-	u32 event;
-};
-
-struct svnet_evt_head {
-	struct list_head list;
-	u32 len;
-	spinlock_t lock;
-};
+#define DEFAULT_RX_BUDGET 64
+#define DEFAULT_TX_BUDGET 16384 /* bytes */
+#define DEFAULT_TX_DELAY 500 /* usecs */
 
 struct svnet {
 	struct net_device *ndev;
 	const struct attribute_group *group;
 
 	struct workqueue_struct *wq;
-	struct work_struct work_read;
+	struct delayed_work work_read;
 	struct delayed_work work_write;
 	struct delayed_work work_rx;
 
@@ -100,7 +98,27 @@ struct svnet {
 	int exit_flag;
 
 	struct sk_buff_head txq;
-	struct svnet_evt_head rxq;
+
+	/*
+	 * RX is polled: the first mailbox schedules work_read and masks
+	 * further data mailboxes, which are only accumulated in rx_mailbox,
+	 * until a poll pass finds the rings drained within rx_budget.
+	 */
+	spinlock_t rx_lock;
+	u32 rx_mailbox;
+	int rx_masked;
+	int rx_budget;
+
+	/*
+	 * PDP packets are batched: the first one arms tx_timer and the
+	 * write work runs when it expires, or at once when tx_budget bytes
+	 * are queued. Every batch costs one OneDRAM ownership round trip.
+	 */
+	struct hrtimer tx_timer;
+	unsigned long tx_armed;
+	atomic_t tx_bytes;
+	unsigned int tx_budget;
+	unsigned int tx_delay; /* usecs, 0 writes every packet at once */
 
 	struct sipc *si;
 #ifdef CONFIG_HAS_WAKELOCK
@@ -180,8 +198,6 @@ static unsigned long long time_max_write;
 
 extern unsigned long long time_max_semlat;
 
-static int _queue_evt(struct svnet_evt_head *h, u32 event);
-
 static ssize_t show_version(struct device *d,
 		struct device_attribute *attr, char *buf)
 {
@@ -237,6 +253,10 @@ static inline int _show_stat(char *buf)
 	p += sprintf(p, "\twrite count: %lu\n", stat.st_do_write);
 	p += sprintf(p, "\tread count: %lu\n", stat.st_do_read);
 	p += sprintf(p, "\trx count: %lu\n", stat.st_do_rx);
+	p += sprintf(p, "\tmasked mailbox: %lu\n", stat.st_rx_masked);
+	p += sprintf(p, "\tbudget exhausted: %lu\n", stat.st_rx_budget);
+	p += sprintf(p, "\ttx flush by deadline: %lu\n", stat.st_tx_deadline);
+	p += sprintf(p, "\ttx flush by budget: %lu\n", stat.st_tx_budget);
 	p += sprintf(p, "\n");
 
 	return p - buf;
@@ -256,6 +276,87 @@ static ssize_t show_latency(struct device *d,
 	return p - buf;
 }
 
+static ssize_t show_rx_budget(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	if (!svnet_dev)
+		return 0;
+
+	return sprintf(buf, "%d\n", svnet_dev->rx_budget);
+}
+
+static ssize_t store_rx_budget(struct device *d,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long budget;
+	int r;
+
+	if (!svnet_dev)
+		return count;
+
+	r = strict_strtoul(buf, 10, &budget);
+	if (r || !budget || budget > INT_MAX)
+		return -EINVAL;
+
+	svnet_dev->rx_budget = budget;
+
+	return count;
+}
+
+static ssize_t show_tx_budget(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	if (!svnet_dev)
+		return 0;
+
+	return sprintf(buf, "%u\n", svnet_dev->tx_budget);
+}
+
+static ssize_t store_tx_budget(struct device *d,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long budget;
+	int r;
+
+	if (!svnet_dev)
+		return count;
+
+	r = strict_strtoul(buf, 10, &budget);
+	if (r || !budget || budget > INT_MAX)
+		return -EINVAL;
+
+	svnet_dev->tx_budget = budget;
+
+	return count;
+}
+
+static ssize_t show_tx_delay(struct device *d,
+		struct device_attribute *attr, char *buf)
+{
+	if (!svnet_dev)
+		return 0;
+
+	return sprintf(buf, "%u\n", svnet_dev->tx_delay);
+}
+
+static ssize_t store_tx_delay(struct device *d,
+		struct device_attribute *attr, const char *buf, size_t count)
+{
+	unsigned long usecs;
+	int r;
+
+	if (!svnet_dev)
+		return count;
+
+	r = strict_strtoul(buf, 10, &usecs);
+	if (r || usecs > USEC_PER_SEC)
+		return -EINVAL;
+
+	svnet_dev->tx_delay = usecs;
+
+	return count;
+}
+
 static ssize_t show_debug(struct device *d,
 		struct device_attribute *attr, char *buf)
 {
@@ -268,7 +369,8 @@ static ssize_t show_debug(struct device *d,
 
 	p += sprintf(p, "Event queue ----- \n");
 	p += sprintf(p, "\tTX queue\t%u\n", skb_queue_len(&svnet_dev->txq));
-	p += sprintf(p, "\tRX queue\t%u\n", svnet_dev->rxq.len);
+	p += sprintf(p, "\tRX mailbox\t%x%s\n", svnet_dev->rx_mailbox,
+			svnet_dev->rx_masked ? " (polling)" : "");
 
 	p += sipc_debug_show(svnet_dev->si, p);
 
@@ -316,6 +418,9 @@ static DEVICE_ATTR(latency, 0664, show_latency, NULL);
 static DEVICE_ATTR(waketime, 0664, show_waketime, store_waketime);
 static DEVICE_ATTR(debug, 0664, show_debug, store_debug);
 static DEVICE_ATTR(whitelist, 0664, NULL, store_whitelist);
+static DEVICE_ATTR(rx_budget, 0664, show_rx_budget, store_rx_budget);
+static DEVICE_ATTR(tx_budget, 0664, show_tx_budget, store_tx_budget);
+static DEVICE_ATTR(tx_delay, 0664, show_tx_delay, store_tx_delay);
 
 static struct attribute *svnet_attributes[] = {
 	&dev_attr_version.attr,
@@ -323,6 +428,9 @@ static struct attribute *svnet_attributes[] = {
 	&dev_attr_debug.attr,
 	&dev_attr_latency.attr,
 	&dev_attr_whitelist.attr,
+	&dev_attr_rx_budget.attr,
+	&dev_attr_tx_budget.attr,
+	&dev_attr_tx_delay.attr,
 	NULL
 };
 
@@ -331,10 +439,39 @@ static const struct attribute_group svnet_group = {
 };
 
 
+static enum hrtimer_restart _tx_deadline(struct hrtimer *timer)
+{
+	struct svnet *sn = container_of(timer, struct svnet, tx_timer);
+
+	clear_bit(0, &sn->tx_armed);
+	stat.st_tx_deadline++;
+	queue_delayed_work(sn->wq, &sn->work_write, 0);
+
+	return HRTIMER_NORESTART;
+}
+
+static void _tx_schedule(struct svnet *sn, unsigned int len)
+{
+	if (!sn->tx_delay ||
+			atomic_add_return(len, &sn->tx_bytes) >= sn->tx_budget) {
+		if (sn->tx_delay)
+			stat.st_tx_budget++;
+		queue_delayed_work(sn->wq, &sn->work_write, 0);
+		return;
+	}
+
+	/* the deadline belongs to the oldest packet, do not push it out */
+	if (!test_and_set_bit(0, &sn->tx_armed))
+		hrtimer_start(&sn->tx_timer,
+				ns_to_ktime((u64)sn->tx_delay * NSEC_PER_USEC),
+				HRTIMER_MODE_REL);
+}
+
 int vnet_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 {
 	struct svnet *sn;
 	struct pdp_priv *priv;
+	unsigned int len;
 
 	dev_dbg(&ndev->dev, "recv inet packet %p: %d bytes\n", skb, skb->len);
 	stat.st_recv_pkt_pdp++;
@@ -350,10 +487,11 @@ int vnet_start_xmit(struct sk_buff *skb, struct net_device *ndev)
 	if (!tmp_xtow)
 		tmp_xtow = cpu_clock(smp_processor_id());
 
+	len = skb->len;
 	skb_queue_tail(&sn->txq, skb);
 
 	_wake_process_lock_timeout(sn);
-	queue_delayed_work(sn->wq, &sn->work_write, 0);
+	_tx_schedule(sn, len);
 
 	return NETDEV_TX_OK;
 
@@ -398,65 +536,6 @@ drop:
 	return NETDEV_TX_OK;
 }
 
-static int _queue_evt(struct svnet_evt_head *h, u32 event)
-{
-	unsigned long flags;
-	struct svnet_evt *e;
-
-	e = kmalloc(sizeof(struct svnet_evt), GFP_ATOMIC);
-	if (!e)
-		return -ENOMEM;
-
-	e->event = event;
-
-	spin_lock_irqsave(&h->lock, flags);
-	list_add_tail(&e->list, &h->list);
-	h->len++;
-	spin_unlock_irqrestore(&h->lock, flags);
-
-	return 0;
-}
-
-static void _queue_purge(struct svnet_evt_head *h)
-{
-	unsigned long flags;
-	struct svnet_evt *e, *next;
-
-	spin_lock_irqsave(&h->lock, flags);
-	list_for_each_entry_safe(e, next, &h->list, list) {
-		list_del(&e->list);
-		h->len--;
-		kfree(e);
-	}
-	spin_unlock_irqrestore(&h->lock, flags);
-}
-
-static u32 _dequeue_evt(struct svnet_evt_head *h)
-{
-	unsigned long flags;
-	struct list_head *p;
-	struct svnet_evt *e;
-	u32 event;
-
-	spin_lock_irqsave(&h->lock, flags);
-	p = h->list.next;
-	if (p == &h->list) {
-		e = NULL;
-		event = 0;
-	} else {
-		e = list_entry(p, struct svnet_evt, list);
-		list_del(&e->list);
-		h->len--;
-		event = e->event;
-	}
-	spin_unlock_irqrestore(&h->lock, flags);
-
-	if (e)
-		kfree(e);
-
-	return event;
-}
-
 static int _proc_private_event(struct svnet *sn, u32 evt)
 {
 	switch(evt) {
@@ -477,10 +556,34 @@ static int _proc_private_event(struct svnet *sn, u32 evt)
 	return 1;
 }
 
+/*
+ * Unmask data mailboxes after a poll pass. Returns 0 when polling stops;
+ * if a mailbox came in meanwhile it stays masked and the caller polls
+ * again, unless 'drop' asks to forget it.
+ */
+static int _rx_unmask(struct svnet *sn, int drop)
+{
+	unsigned long flags;
+	int r = 0;
+
+	spin_lock_irqsave(&sn->rx_lock, flags);
+	if (drop)
+		sn->rx_mailbox = 0;
+	if (sn->rx_mailbox)
+		r = 1;
+	else
+		sn->rx_masked = 0;
+	spin_unlock_irqrestore(&sn->rx_lock, flags);
+
+	return r;
+}
+
 static void svnet_queue_event(u32 evt, void *data)
 {
 	struct net_device *ndev = (struct net_device *)data;
 	struct svnet *sn;
+	unsigned long flags;
+	int masked;
 	int r;
 
 	if (!tmp_itor)
@@ -499,14 +602,19 @@ static void svnet_queue_event(u32 evt, void *data)
 	if (r)
 		return;
 
-	r = _queue_evt(&sn->rxq, evt);
-	if (r) {
-		dev_err(&sn->ndev->dev, "Not enough memory: event skipped\n");
+	spin_lock_irqsave(&sn->rx_lock, flags);
+	sn->rx_mailbox |= evt;
+	masked = sn->rx_masked;
+	sn->rx_masked = 1;
+	spin_unlock_irqrestore(&sn->rx_lock, flags);
+
+	if (masked) {
+		stat.st_rx_masked++;
 		return;
 	}
 
 	_wake_process_lock_timeout(sn);
-	queue_work(sn->wq, &sn->work_read);
+	queue_delayed_work(sn->wq, &sn->work_read, 0);
 }
 
 static int svnet_open(struct net_device *ndev)
@@ -536,9 +644,13 @@ static int svnet_close(struct net_device *ndev)
 
 	dev_dbg(&ndev->dev, "%s\n", __func__);
 
+	cancel_delayed_work_sync(&sn->work_read);
+	hrtimer_cancel(&sn->tx_timer);
+	clear_bit(0, &sn->tx_armed);
 	if (sn->wq)
 		flush_workqueue(sn->wq);
 	skb_queue_purge(&sn->txq);
+	_rx_unmask(sn, 1);
 
 	if (sn->si)
 		sipc_close(&sn->si);
@@ -591,10 +703,12 @@ static void svnet_setup(struct net_device *ndev)
 static void svnet_read_wq(struct work_struct *work)
 {
 	struct svnet *sn = container_of(work,
-			struct svnet, work_read);
+			struct svnet, work_read.work);
+	unsigned long flags;
 	u32 event;
 	int r = 0;
 	int contd = 0;
+	int budget;
 	unsigned long long t, d;
 
 	t = cpu_clock(smp_processor_id());
@@ -610,25 +724,43 @@ static void svnet_read_wq(struct work_struct *work)
 	stat.st_do_read++;
 
 	stat.st_wq_state = 1;
-	event = _dequeue_evt(&sn->rxq);
-	while (event) {
-		// isn't it possible that merge the events?
+	do {
+		spin_lock_irqsave(&sn->rx_lock, flags);
+		event = sn->rx_mailbox;
+		sn->rx_mailbox = 0;
+		spin_unlock_irqrestore(&sn->rx_lock, flags);
+
 		dev_dbg(&sn->ndev->dev, "event %x\n", event);
 
-		if (sn->si) {
-			r = sipc_read(sn->si, event, &contd);
-			if (r < 0) {
-				dev_err(&sn->ndev->dev, "ret %d -> queue %x\n",
-						r, event);
-				_queue_evt(&sn->rxq, event);
-				break;
-			}
-		} else {
+		if (!sn->si) {
 			dev_err(&sn->ndev->dev,
 					"IPC not work, skip event %x\n", event);
+			_rx_unmask(sn, 1);
+			break;
+		}
+
+		budget = sn->rx_budget;
+		r = sipc_poll(sn->si, event, budget, &contd);
+		if (r < 0) {
+			dev_err(&sn->ndev->dev, "ret %d -> retry %x\n",
+					r, event);
+			if (r == -EBADMSG)
+				continue;
+			/* stay masked and retry the same mailbox later */
+			spin_lock_irqsave(&sn->rx_lock, flags);
+			sn->rx_mailbox |= event;
+			spin_unlock_irqrestore(&sn->rx_lock, flags);
+			queue_delayed_work(sn->wq, &sn->work_read, HZ/10);
+			break;
 		}
-		event = _dequeue_evt(&sn->rxq);
-	}
+
+		if (r >= budget) {
+			/* out of budget: let the TX work run, then poll on */
+			stat.st_rx_budget++;
+			queue_delayed_work(sn->wq, &sn->work_read, 0);
+			break;
+		}
+	} while (_rx_unmask(sn, 0));
 
 	if (contd > 0)
 		queue_delayed_work(sn->wq, &sn->work_rx, 0);
@@ -663,6 +795,11 @@ static void svnet_write_wq(struct work_struct *work)
 	int r;
 	unsigned long long t, d;
 
+	/* this pass takes everything queued so far */
+	if (hrtimer_try_to_cancel(&sn->tx_timer) == 1)
+		clear_bit(0, &sn->tx_armed);
+	atomic_set(&sn->tx_bytes, 0);
+
 	t = cpu_clock(smp_processor_id());
 	if (tmp_xtow) {
 		d = t - tmp_xtow;
@@ -677,7 +814,7 @@ static void svnet_write_wq(struct work_struct *work)
 
 	stat.st_wq_state = 3;
 	if (sn->si)
-		r = sipc_write(sn->si, &sn->txq);
+		r = sipc_write(sn->si, &sn->txq, sn->tx_budget);
 	else {
 		skb_queue_purge(&sn->txq);
 		dev_err(&sn->ndev->dev, "IPC not work, drop packet\n");
@@ -699,7 +836,9 @@ static void svnet_write_wq(struct work_struct *work)
 		dev_err(&sn->ndev->dev, "Timed out\n");
 		break;
 	default:
-		/* do nothing */
+		/* stopped by the byte budget, write the rest in a new grant */
+		if (r > 0 && !skb_queue_empty(&sn->txq))
+			queue_delayed_work(sn->wq, &sn->work_write, 0);
 		break;
 	}
 
@@ -748,7 +887,7 @@ static void svnet_exit_wq(struct work_struct *work)
 	envs[0] = uevent_envs[sn->exit_flag];
 	kobject_uevent_env(&sn->ndev->dev.kobj, KOBJ_OFFLINE, envs);
 
-	_queue_purge(&sn->rxq);
+	_rx_unmask(sn, 1);
 	skb_queue_purge(&sn->txq);
 
 	if (sn->exit_flag == SVNET_EXIT)
@@ -764,15 +903,23 @@ static void svnet_exit_wq(struct work_struct *work)
 
 static inline void _init_data(struct svnet *sn)
 {
-	INIT_WORK(&sn->work_read, svnet_read_wq);
+	INIT_DELAYED_WORK(&sn->work_read, svnet_read_wq);
 	INIT_DELAYED_WORK(&sn->work_write, svnet_write_wq);
 	INIT_DELAYED_WORK(&sn->work_rx, svnet_rx_wq);
 	INIT_WORK(&sn->work_exit, svnet_exit_wq);
 
-	INIT_LIST_HEAD(&sn->rxq.list);
-	spin_lock_init(&sn->rxq.lock);
-	sn->rxq.len = 0;
+	spin_lock_init(&sn->rx_lock);
+	sn->rx_mailbox = 0;
+	sn->rx_masked = 0;
+	sn->rx_budget = DEFAULT_RX_BUDGET;
 	skb_queue_head_init(&sn->txq);
+
+	hrtimer_init(&sn->tx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	sn->tx_timer.function = _tx_deadline;
+	sn->tx_armed = 0;
+	atomic_set(&sn->tx_bytes, 0);
+	sn->tx_budget = DEFAULT_TX_BUDGET;
+	sn->tx_delay = DEFAULT_TX_DELAY;
 }
 
 static void _free(struct svnet *sn)
@@ -786,6 +933,7 @@ static void _free(struct svnet *sn)
 		sysfs_remove_group(&sn->ndev->dev.kobj, &svnet_group);
 
 	if (sn->wq) {
+		hrtimer_cancel(&sn->tx_timer);
 		flush_workqueue(sn->wq);
 		destroy_workqueue(sn->wq);
 	}
@@ -46,8 +46,9 @@ extern void sipc_close(struct sipc **);
 
 extern void sipc_exit(void);
 
-extern int sipc_write(struct sipc *, struct sk_buff_head *);
-extern int sipc_read(struct sipc *, u32 mailbox, int *cond);
+extern int sipc_write(struct sipc *, struct sk_buff_head *,
+		unsigned int budget);
+extern int sipc_poll(struct sipc *, u32 mailbox, int budget, int *cond);
 extern int sipc_rx(struct sipc *);
 
 
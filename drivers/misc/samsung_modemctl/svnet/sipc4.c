@@ -30,6 +30,7 @@
 #include "main.h"
 
 #include <linux/circ_buf.h>
+#include <linux/math64.h>
 #include <linux/workqueue.h>
 #include <asm/errno.h>
 
@@ -168,6 +169,9 @@ struct frag_info {
 	u8 msg_id;
 };
 
+/* packets per doorbell histogram: 1, 2-3, 4-7, 8-15, 16 and more */
+#define TX_HIST_MAX 5
+
 struct sipc {
 	struct sipc_mapped *map;
 	struct ringbuf rb[IPCIDX_MAX];
@@ -192,8 +196,27 @@ struct sipc {
 	const struct attribute_group *group;
 
 	struct sk_buff_head rfs_rx;
+
+	/* RX polling */
+	int rx_budget; /* raw packets left in this poll pass */
+	u32 ack_pending; /* res_ack owed once the ring is drained */
+	struct sk_buff_head rx_pool; /* preallocated and recycled RX skbs */
+	unsigned long rx_pool_hit;
+	unsigned long rx_pool_miss;
+	unsigned long rx_recycled;
+
+	/* TX batching */
+	unsigned long tx_doorbell; /* data mailboxes sent by sipc_write */
+	unsigned long tx_batched; /* packets covered by those mailboxes */
+	unsigned long tx_batch_hist[TX_HIST_MAX]; /* packets per doorbell */
+	unsigned long long tx_sem_wait; /* ns spent in _get_auth */
+	unsigned long long tx_sem_wait_max;
 };
 
+/* Room for a PDP packet, or a small phonet one, plus header and trailer */
+#define RX_SKB_SIZE (ETH_DATA_LEN + sizeof(struct phonethdr) + 1)
+#define RX_POOL_MAX 64
+
 /* sizeof(struct phonethdr) + NET_SKB_PAD > SMP_CACHE_BYTES */
 //#define RFS_MTU (PAGE_SIZE - sizeof(struct phonethdr) - NET_SKB_PAD)
 /* SMP_CACHE_BYTES > sizeof(struct phonethdr) + NET_SKB_PAD */
@@ -292,6 +315,49 @@ static u8 _get_msg_id(struct sipc *si)
 	return si->msg_id;
 }
 
+static void _rx_pool_refill(struct sipc *si)
+{
+	struct sk_buff *skb;
+
+	while (skb_queue_len(&si->rx_pool) < RX_POOL_MAX) {
+		skb = __netdev_alloc_skb(si->svndev, RX_SKB_SIZE, GFP_KERNEL);
+		if (!skb)
+			break;
+		skb_queue_tail(&si->rx_pool, skb);
+	}
+}
+
+static struct sk_buff *_rx_alloc_skb(struct sipc *si, struct net_device *ndev,
+		unsigned int len)
+{
+	struct sk_buff *skb = NULL;
+
+	if (len <= RX_SKB_SIZE)
+		skb = skb_dequeue(&si->rx_pool);
+
+	if (skb) {
+		si->rx_pool_hit++;
+		skb->dev = ndev;
+		return skb;
+	}
+
+	si->rx_pool_miss++;
+	return netdev_alloc_skb(ndev, len);
+}
+
+/* a written TX skb goes back to the RX pool when it is big enough */
+static void _tx_done(struct sipc *si, struct sk_buff *skb)
+{
+	if (skb_queue_len(&si->rx_pool) < RX_POOL_MAX &&
+			skb_recycle_check(skb, RX_SKB_SIZE)) {
+		skb_queue_tail(&si->rx_pool, skb);
+		si->rx_recycled++;
+		return;
+	}
+
+	dev_kfree_skb_any(skb);
+}
+
 static int _get_auth(void)
 {
 	int r;
@@ -536,6 +602,8 @@ struct sipc* sipc_open(void (*queue)(u32, void*), struct net_device *ndev)
 	}
 	
 	skb_queue_head_init(&si->rfs_rx);
+	skb_queue_head_init(&si->rx_pool);
+	_rx_pool_refill(si);
 
 	/* process init message */
 	_init_proc(si);
@@ -593,6 +661,8 @@ void sipc_close(struct sipc **psi)
 	if (si->frag_buf)
 		kfree(si->frag_buf);
 
+	skb_queue_purge(&si->rx_pool);
+
 	if (si->queue)
 		onedram_unregister_handler(sipc_handler);
 
@@ -906,11 +976,35 @@ static inline int _write_pn(struct sipc *si, struct sk_buff *skb, u32 *mb)
 	return r;
 }
 
-int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
+static void _tx_account(struct sipc *si, unsigned long long wait,
+		unsigned int cnt)
+{
+	si->tx_sem_wait += wait;
+	if (wait > si->tx_sem_wait_max)
+		si->tx_sem_wait_max = wait;
+
+	if (!cnt)
+		return;
+
+	si->tx_doorbell++;
+	si->tx_batched += cnt;
+	si->tx_batch_hist[min(fls(cnt), TX_HIST_MAX) - 1]++;
+}
+
+/*
+ * Write the queued packets under a single ownership grant and ring the
+ * doorbell once for all of them. A non-zero budget bounds the bytes
+ * written per grant so that the modem is not locked out of the memory
+ * by a long upload; the packets left over stay queued for the caller.
+ * Returns the number of packets written or a negative error.
+ */
+int sipc_write(struct sipc *si, struct sk_buff_head *sbh, unsigned int budget)
 {
 	int r;
 	u32 mailbox;
 	struct sk_buff *skb;
+	unsigned int cnt, bytes;
+	unsigned long long t, wait;
 
 	if (!sbh)
 		return -EINVAL;
@@ -920,8 +1014,15 @@ int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
 		return -ENXIO;
 	}
 
+	/* a flush deadline may expire after the queue was drained */
+	if (skb_queue_empty(sbh))
+		return 0;
+
+	t = cpu_clock(smp_processor_id());
 	r = _get_auth();
+	wait = cpu_clock(smp_processor_id()) - t;
 	if (r) {
+		_tx_account(si, wait, 0);
 		if (factory_test_force_sleep){
 			printk("tx ignored for factory force sleep\n");
 			skb_queue_purge(sbh);
@@ -932,6 +1033,7 @@ int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
 	}
 
 	r = mailbox = 0;
+	cnt = bytes = 0;
 	skb = skb_dequeue(sbh);
 	while (skb) {
 		struct net_device *ndev = skb->dev;
@@ -950,7 +1052,12 @@ int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
 			break;
 
 		_update_stat(ndev, len);
-		dev_kfree_skb_any(skb);
+		_tx_done(si, skb);
+		cnt++;
+		bytes += len;
+
+		if (budget && bytes >= budget)
+			break;
 
 		skb = skb_dequeue(sbh);
 	}
@@ -961,6 +1068,8 @@ int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
 	if(mailbox)
 		onedram_write_mailbox(MB_DATA(mailbox));
 
+	_tx_account(si, wait, mailbox ? cnt : 0);
+
 	if (r < 0) {
 		if (r == -ENOSPC) {
 			dev_err(&si->svndev->dev,
@@ -972,9 +1081,10 @@ int sipc_write(struct sipc *si, struct sk_buff_head *sbh)
 					"write err %d, drop %p\n", r, skb);
 			dev_kfree_skb_any(skb);
 		}
+		return r;
 	}
 
-	return r;
+	return cnt;
 }
 
 extern int __read(struct ringbuf *rb, unsigned char *buf, unsigned int size)
@@ -1047,8 +1157,8 @@ static inline void _phonet_rx(struct net_device *ndev,
 	_dbg("%s: res 0x%02x packet %p len %d\n", __func__, res, skb, skb->len);
 }
 
-static int _read_pn(struct net_device *ndev, struct ringbuf *rb, int len,
-		int res)
+static int _read_pn(struct sipc *si, struct net_device *ndev,
+		struct ringbuf *rb, int len, int res)
 {
 	int r;
 	struct sk_buff *skb;
@@ -1057,7 +1167,7 @@ static int _read_pn(struct net_device *ndev, struct ringbuf *rb, int len,
 
 	_dbg("%s: res 0x%02x data %d\n", __func__, res, len);
 
-	skb = netdev_alloc_skb(ndev, read_len + sizeof(struct phonethdr));
+	skb = _rx_alloc_skb(si, ndev, read_len + sizeof(struct phonethdr));
 	if (unlikely(!skb))
 		return -ENOMEM;
 
@@ -1195,7 +1305,7 @@ free_skb:
 	return r;
 }
 
-static int _read_pdp(struct ringbuf *rb, int len,
+static int _read_pdp(struct sipc *si, struct ringbuf *rb, int len,
 		int res)
 {
 	int r;
@@ -1216,7 +1326,7 @@ static int _read_pdp(struct ringbuf *rb, int len,
 		return r;
 	}
 
-	skb = netdev_alloc_skb(ndev, read_len);
+	skb = _rx_alloc_skb(si, ndev, read_len);
 	if (unlikely(!skb)) {
 		mutex_unlock(&pdp_mutex);
 		return -ENOMEM;
@@ -1256,7 +1366,7 @@ static int _read_raw(struct sipc *si, int inbuf, struct ringbuf *rb)
 	int res, data_len;
 	u32 tail;
 
-	while (inbuf > 0) {
+	while (inbuf > 0 && si->rx_budget > 0) {
 		tail = rb->rb_in_tail;
 
 		r = __read(rb, buf, sizeof(buf));
@@ -1273,9 +1383,9 @@ static int _read_raw(struct sipc *si, int inbuf, struct ringbuf *rb)
 		data_len -= sizeof(struct raw_hdr);
 
 		if (res >= PN_PDP_START && res <= PN_PDP_END) {
-			r = _read_pdp(rb, data_len, res);
+			r = _read_pdp(si, rb, data_len, res);
 		} else {
-			r = _read_pn(si->svndev, rb, data_len, res);
+			r = _read_pn(si, si->svndev, rb, data_len, res);
 		}
 
 		if (r < 0) {
@@ -1286,6 +1396,7 @@ static int _read_raw(struct sipc *si, int inbuf, struct ringbuf *rb)
 		}
 
 		inbuf -= r;
+		si->rx_budget--;
 	}
 
 	return 0;
@@ -1570,7 +1681,13 @@ static inline void purge_buffer(struct ringbuf *rb)
 	rb->rb_in_tail = rb->rb_in_head;
 }
 
-int sipc_read(struct sipc *si, u32 mailbox, int *cond)
+/*
+ * Drain the IN rings while holding the OneDRAM authority. At most
+ * 'budget' raw packets are delivered per call so that a busy data
+ * channel cannot starve TX; returns the number of raw packets read.
+ * The acknowledge the modem asked for is sent once its ring is empty.
+ */
+int sipc_poll(struct sipc *si, u32 mailbox, int budget, int *cond)
 {
 	int r = 0;
 	int i;
@@ -1579,10 +1696,13 @@ int sipc_read(struct sipc *si, u32 mailbox, int *cond)
 	if (!si)
 		return -EINVAL;
 
+	_rx_pool_refill(si);
+
 	r = _get_auth();
 	if (r)
 		return r;
 
+	si->rx_budget = budget;
 	for (i=0;i<IPCIDX_MAX;i++) {
 		int inbuf;
 		struct ringbuf *rb;
@@ -1590,29 +1710,35 @@ int sipc_read(struct sipc *si, u32 mailbox, int *cond)
 //		if (!check_mailbox(mailbox, i))
 //			continue;
 
+		si->ack_pending |= mailbox & mb_data[i].mask_req_ack;
+
 		rb = &si->rb[i];
 		inbuf = CIRC_CNT(rb->rb_in_head, rb->rb_in_tail, rb->rb_size);
-		if (!inbuf)
-			continue;
+		if (inbuf) {
+			if (i == IPCIDX_FMT)
+				_fmt_wakelock_timeout();
+			else
+				_non_fmt_wakelock_timeout();
 
-		if (i == IPCIDX_FMT)
-			_fmt_wakelock_timeout();
-		else
-			_non_fmt_wakelock_timeout();			
+			_dbg("%s: %d bytes in %d\n", __func__, inbuf, i);
 
-		_dbg("%s: %d bytes in %d\n", __func__, inbuf, i);
+			r = rb->rb_read(si, inbuf, rb);
+			if (r < 0) {
+				if (r == -EBADMSG)
+					purge_buffer(rb);
 
-		r = rb->rb_read(si, inbuf, rb);
-		if (r < 0) {
-			if (r == -EBADMSG)
-				purge_buffer(rb);
+				dev_err(&si->svndev->dev, "read err %d\n", r);
+				break;
+			}
 
-			dev_err(&si->svndev->dev, "read err %d\n", r);
-			break;
+			inbuf = CIRC_CNT(rb->rb_in_head, rb->rb_in_tail,
+					rb->rb_size);
 		}
 
-		if (mailbox & mb_data[i].mask_req_ack)
-			res = mb_data[i].mask_res_ack;
+		if (!inbuf && (si->ack_pending & mb_data[i].mask_req_ack)) {
+			si->ack_pending &= ~mb_data[i].mask_req_ack;
+			res |= mb_data[i].mask_res_ack;
+		}
 	}
 
 #if !defined(CONFIG_ARIES_NTT)
@@ -1626,7 +1752,10 @@ int sipc_read(struct sipc *si, u32 mailbox, int *cond)
 
 	*cond =	skb_queue_len(&si->rfs_rx);
 
-	return r;
+	if (r < 0)
+		return r;
+
+	return budget - si->rx_budget;
 }
 
 int sipc_rx(struct sipc *si)
@@ -1700,6 +1829,29 @@ static inline ssize_t _debug_show_pdp(struct sipc *si, char *buf)
 	return p - buf;
 }
 
+static int _debug_show_tx(struct sipc *si, char *buf)
+{
+	char *p = buf;
+	unsigned long avg = 0;
+	unsigned long long wait = 0;
+
+	if (si->tx_doorbell) {
+		avg = si->tx_batched * 100 / si->tx_doorbell;
+		wait = div_u64(si->tx_sem_wait, si->tx_doorbell);
+	}
+
+	p += sprintf(p, "\nTX: %lu packets, %lu doorbells, %lu.%02lu per doorbell\n",
+			si->tx_batched, si->tx_doorbell, avg / 100, avg % 100);
+	p += sprintf(p, "TX batch: 1:%lu 2-3:%lu 4-7:%lu 8-15:%lu 16+:%lu\n",
+			si->tx_batch_hist[0], si->tx_batch_hist[1],
+			si->tx_batch_hist[2], si->tx_batch_hist[3],
+			si->tx_batch_hist[4]);
+	p += sprintf(p, "TX sem. wait: %llu ns total, %llu ns max, %llu ns avg\n",
+			si->tx_sem_wait, si->tx_sem_wait_max, wait);
+
+	return p - buf;
+}
+
 ssize_t sipc_debug_show(struct sipc *si, char *buf)
 {
 	char *p = buf;
@@ -1711,6 +1863,12 @@ ssize_t sipc_debug_show(struct sipc *si, char *buf)
 
 	p += _debug_show_pdp(si, p);
 
+	p += sprintf(p, "\nRX pool: %u skbs, %lu hit, %lu miss, %lu recycled\n",
+			skb_queue_len(&si->rx_pool), si->rx_pool_hit,
+			si->rx_pool_miss, si->rx_recycled);
+
+	p += _debug_show_tx(si, p);
+
 	p += sprintf(p, "\nDebug command -----------\n");
 	p += sprintf(p, "R0\tcopy FMT out to in\n");
 	p += sprintf(p, "R1\tcopy RAW out to in\n");
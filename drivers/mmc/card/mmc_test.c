@@ -81,6 +81,24 @@ struct mmc_test_area {
 	struct scatterlist *sg;
 };
 
+/**
+ * struct mmc_test_async_req - one request of a non-blocking transfer.
+ * @areq: request handed to mmc_start_req()
+ * @test: test the request belongs to
+ * @mrq: MMC request
+ * @cmd: read/write command
+ * @stop: stop command
+ * @data: data part of @mrq
+ */
+struct mmc_test_async_req {
+	struct mmc_async_req areq;
+	struct mmc_test_card *test;
+	struct mmc_request mrq;
+	struct mmc_command cmd;
+	struct mmc_command stop;
+	struct mmc_data data;
+};
+
 /**
  * struct mmc_test_transfer_result - transfer results for performance tests.
  * @link: double-linked list
@@ -745,6 +763,60 @@ static int mmc_test_simple_transfer(struct mmc_test_card *test,
 	return mmc_test_check_result(test, &mrq);
 }
 
+static int mmc_test_check_result_async(struct mmc_card *card,
+				       struct mmc_async_req *areq)
+{
+	struct mmc_test_async_req *rq =
+		container_of(areq, struct mmc_test_async_req, areq);
+
+	mmc_test_wait_busy(rq->test);
+
+	return mmc_test_check_result(rq->test, areq->mrq);
+}
+
+/*
+ * Tests count back-to-back transfers with certain parameters, letting the
+ * host prepare each transfer while the previous one is still in flight
+ */
+static int mmc_test_nonblock_transfer(struct mmc_test_card *test,
+	struct scatterlist *sg, unsigned sg_len, unsigned dev_addr,
+	unsigned blocks, unsigned blksz, int write, unsigned count)
+{
+	struct mmc_test_async_req rq[2];
+	struct mmc_test_async_req *cur = &rq[0], *other = &rq[1], *tmp;
+	struct mmc_async_req *done;
+	unsigned i;
+	int ret = 0;
+
+	for (i = 0; i < count; i++) {
+		memset(cur, 0, sizeof(*cur));
+		cur->test = test;
+		cur->mrq.cmd = &cur->cmd;
+		cur->mrq.data = &cur->data;
+		cur->mrq.stop = &cur->stop;
+		cur->areq.mrq = &cur->mrq;
+		cur->areq.err_check = mmc_test_check_result_async;
+
+		mmc_test_prepare_mrq(test, &cur->mrq, sg, sg_len, dev_addr,
+			blocks, blksz, write);
+
+		done = mmc_start_req(test->card->host, &cur->areq, &ret);
+		if (ret || (!done && i > 0))
+			goto out;
+
+		tmp = cur;
+		cur = other;
+		other = tmp;
+		dev_addr += blocks;
+	}
+
+	mmc_start_req(test->card->host, NULL, &ret);
+out:
+	if (ret == -EINVAL)
+		ret = RESULT_UNSUP_HOST;
+	return ret;
+}
+
 /*
  * Tests a transfer where the card will fail completely or partly
  */
@@ -1954,6 +2026,101 @@ static int mmc_test_large_seq_write_perf(struct mmc_test_card *test)
 	return mmc_test_large_seq_perf(test, 1);
 }
 
+/*
+ * Sequential transfers across the test area, sz bytes at a time, issued
+ * either one by one or as non-blocking requests.
+ */
+static int mmc_test_rw_seq_perf(struct mmc_test_card *test, unsigned long sz,
+				int write, int nonblock)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned int dev_addr, cnt, i;
+	struct timespec ts1, ts2;
+	int ret;
+
+	ret = mmc_test_area_map(test, sz, 0);
+	if (ret)
+		return ret;
+
+	cnt = t->max_sz / sz;
+	dev_addr = t->dev_addr;
+
+	if (write) {
+		ret = mmc_test_area_erase(test);
+		if (ret)
+			return ret;
+	}
+
+	getnstimeofday(&ts1);
+	if (nonblock) {
+		ret = mmc_test_nonblock_transfer(test, t->sg, t->sg_len,
+						 dev_addr, t->blocks, 512,
+						 write, cnt);
+		if (ret)
+			return ret;
+	} else {
+		for (i = 0; i < cnt; i++) {
+			ret = mmc_test_area_transfer(test, dev_addr, write);
+			if (ret)
+				return ret;
+			dev_addr += t->blocks;
+		}
+	}
+	getnstimeofday(&ts2);
+
+	mmc_test_print_avg_rate(test, sz, cnt, &ts1, &ts2);
+
+	return 0;
+}
+
+static int mmc_test_rw_seq_perf_by_size(struct mmc_test_card *test,
+					int write, int nonblock)
+{
+	struct mmc_test_area *t = &test->area;
+	unsigned long sz;
+	int ret;
+
+	for (sz = 4096; sz < t->max_tfr; sz <<= 1) {
+		ret = mmc_test_rw_seq_perf(test, sz, write, nonblock);
+		if (ret)
+			return ret;
+	}
+
+	return mmc_test_rw_seq_perf(test, t->max_tfr, write, nonblock);
+}
+
+/*
+ * Sequential read performance with blocking requests.
+ */
+static int mmc_test_profile_seq_read_blocking_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_seq_perf_by_size(test, 0, 0);
+}
+
+/*
+ * Sequential read performance with non-blocking requests.
+ */
+static int mmc_test_profile_seq_read_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_seq_perf_by_size(test, 0, 1);
+}
+
+/*
+ * Sequential write performance with blocking requests.
+ */
+static int mmc_test_profile_seq_write_blocking_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_seq_perf_by_size(test, 1, 0);
+}
+
+/*
+ * Sequential write performance with non-blocking requests.
+ */
+static int mmc_test_profile_seq_write_nonblock_perf(struct mmc_test_card *test)
+{
+	return mmc_test_rw_seq_perf_by_size(test, 1, 1);
+}
+
 static const struct mmc_test_case mmc_test_cases[] = {
 	{
 		.name = "Basic write (no data verification)",
@@ -2221,6 +2388,34 @@ static const struct mmc_test_case mmc_test_cases[] = {
 		.cleanup = mmc_test_area_cleanup,
 	},
 
+	{
+		.name = "Sequential read performance with blocking req",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_profile_seq_read_blocking_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Sequential read performance with non-blocking req",
+		.prepare = mmc_test_area_prepare_fill,
+		.run = mmc_test_profile_seq_read_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Sequential write performance with blocking req",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_seq_write_blocking_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
+	{
+		.name = "Sequential write performance with non-blocking req",
+		.prepare = mmc_test_area_prepare,
+		.run = mmc_test_profile_seq_write_nonblock_perf,
+		.cleanup = mmc_test_area_cleanup,
+	},
+
 };
 
 static DEFINE_MUTEX(mmc_test_lock);
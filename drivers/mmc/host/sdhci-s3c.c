@@ -542,6 +542,19 @@ static int __devinit sdhci_s3c_probe(struct platform_device *pdev)
 	/* PIO currently has problems with multi-block IO */
 	host->quirks |= SDHCI_QUIRK_NO_MULTIBLOCK;
 
+#elif defined(CONFIG_MMC_SDHCI_S3C_ADMA)
+
+	/* The HSMMC block implements ADMA2, but not every revision
+	 * reports it in the capabilities register, so add it here. */
+	host->caps = readl(host->ioaddr + SDHCI_CAPABILITIES) |
+		     SDHCI_CAN_DO_ADMA2;
+	host->quirks |= SDHCI_QUIRK_MISSING_CAPS;
+
+#else
+
+	/* Stick to SDMA unless ADMA2 has been asked for. */
+	host->quirks |= SDHCI_QUIRK_BROKEN_ADMA;
+
 #endif /* CONFIG_MMC_SDHCI_S3C_DMA */
 
 	/* It seems we do not get an DATA transfer complete on non-busy
@@ -187,6 +187,7 @@ typedef struct dhd_pub {
 	ulong wd_dpc_sched;   /* Number of times dhd dpc scheduled by watchdog timer */
 
 	ulong rx_readahead_cnt;	/* Number of packets where header read-ahead was used. */
+	ulong rx_batches;	/* Number of packet batches handed to the network stack */
 	ulong tx_realloc;	/* Number of tx packets we had to realloc for headroom */
 	ulong fc_packets;       /* Number of flow control pkts recvd */
 
@@ -423,6 +424,7 @@ extern void dhd_os_sdlock_txq(dhd_pub_t * pub);
 extern void dhd_os_sdunlock_txq(dhd_pub_t * pub);
 extern void dhd_os_sdlock_rxq(dhd_pub_t * pub);
 extern void dhd_os_sdunlock_rxq(dhd_pub_t * pub);
+extern void dhd_os_rxflush(dhd_pub_t * pub);
 extern void dhd_os_sdlock_sndup_rxq(dhd_pub_t * pub);
 extern void dhd_customer_gpio_wlan_ctrl(int onoff);
 extern int dhd_custom_get_mac_address(unsigned char *buf);
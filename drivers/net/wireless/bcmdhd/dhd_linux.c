@@ -287,6 +287,14 @@ typedef struct dhd_info {
 #ifdef ARP_OFFLOAD_SUPPORT
 	u32 pend_ipaddr;
 #endif /* ARP_OFFLOAD_SUPPORT */
+
+#ifdef DHD_RX_NAPI
+	/* Rx packets are collected per DPC pass and given to GRO from NAPI */
+	struct napi_struct rx_napi;
+	struct sk_buff_head rx_pend_queue;	/* DPC context only */
+	struct sk_buff_head rx_napi_queue;	/* DPC -> NAPI handoff */
+	struct sk_buff_head rx_process_queue;	/* NAPI context only */
+#endif /* DHD_RX_NAPI */
 } dhd_info_t;
 
 /* Definitions to provide path to the firmware and nvram
@@ -359,6 +367,12 @@ module_param(dhd_dpc_prio, int, 0);
 extern int dhd_dongle_memsize;
 module_param(dhd_dongle_memsize, int, 0);
 #endif /* DHDTHREAD */
+
+#ifdef DHD_RX_NAPI
+/* Packets given to GRO per NAPI poll */
+uint dhd_napi_weight = 64;
+module_param(dhd_napi_weight, uint, 0);
+#endif /* DHD_RX_NAPI */
 /* Control fw roaming */
 uint dhd_roam_disable = 0;
 
@@ -393,8 +407,14 @@ module_param(dhd_sdiod_drive_strength, uint, 0);
 /* Tx/Rx bounds */
 extern uint dhd_txbound;
 extern uint dhd_rxbound;
-module_param(dhd_txbound, uint, 0);
-module_param(dhd_rxbound, uint, 0);
+module_param(dhd_txbound, uint, 0644);
+module_param(dhd_rxbound, uint, 0644);
+
+/* Resize the bounds per DPC pass, aiming at passes shorter than dhd_dpc_target_us */
+extern uint dhd_dpc_adapt;
+extern uint dhd_dpc_target_us;
+module_param(dhd_dpc_adapt, uint, 0644);
+module_param(dhd_dpc_target_us, uint, 0644);
 
 /* Deferred transmits */
 extern uint dhd_deferred_tx;
@@ -1561,6 +1581,10 @@ dhd_rx_frame(dhd_pub_t *dhdp, int ifidx, void *pktbuf, int numpkt, uint8 chan)
 		dhdp->dstats.rx_bytes += skb->len;
 		dhdp->rx_packets++; /* Local count */
 
+#ifdef DHD_RX_NAPI
+		/* Delivered with the rest of the DPC pass by dhd_os_rxflush() */
+		__skb_queue_tail(&dhd->rx_pend_queue, skb);
+#else
 		if (in_interrupt()) {
 			netif_rx(skb);
 		} else {
@@ -1580,12 +1604,69 @@ dhd_rx_frame(dhd_pub_t *dhdp, int ifidx, void *pktbuf, int numpkt, uint8 chan)
 			local_irq_restore(flags);
 #endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) */
 		}
+#endif /* DHD_RX_NAPI */
 	}
 
 	DHD_OS_WAKE_LOCK_RX_TIMEOUT_ENABLE(dhdp, tout_rx);
 	DHD_OS_WAKE_LOCK_CTRL_TIMEOUT_ENABLE(dhdp, tout_ctrl);
 }
 
+#ifdef DHD_RX_NAPI
+static int
+dhd_napi_poll(struct napi_struct *napi, int budget)
+{
+	dhd_info_t *dhd = container_of(napi, dhd_info_t, rx_napi);
+	struct sk_buff *skb;
+	unsigned long flags;
+	int processed = 0;
+
+	if (skb_queue_empty(&dhd->rx_process_queue)) {
+		spin_lock_irqsave(&dhd->rx_napi_queue.lock, flags);
+		skb_queue_splice_tail_init(&dhd->rx_napi_queue, &dhd->rx_process_queue);
+		spin_unlock_irqrestore(&dhd->rx_napi_queue.lock, flags);
+	}
+
+	while (processed < budget &&
+	       (skb = __skb_dequeue(&dhd->rx_process_queue)) != NULL) {
+		napi_gro_receive(napi, skb);
+		processed++;
+	}
+
+	if (processed < budget) {
+		napi_complete(napi);
+		/* The DPC may have queued more after the splice above */
+		if (!skb_queue_empty(&dhd->rx_napi_queue))
+			napi_schedule(napi);
+	}
+
+	return processed;
+}
+#endif /* DHD_RX_NAPI */
+
+/* Hand the packets collected by dhd_rx_frame() in this DPC pass to the stack */
+void
+dhd_os_rxflush(dhd_pub_t *pub)
+{
+#ifdef DHD_RX_NAPI
+	dhd_info_t *dhd = (dhd_info_t *)pub->info;
+	unsigned long flags;
+
+	if (skb_queue_empty(&dhd->rx_pend_queue))
+		return;
+
+	spin_lock_irqsave(&dhd->rx_napi_queue.lock, flags);
+	skb_queue_splice_tail_init(&dhd->rx_pend_queue, &dhd->rx_napi_queue);
+	spin_unlock_irqrestore(&dhd->rx_napi_queue.lock, flags);
+
+	pub->rx_batches++;
+
+	/* From the DPC thread, let the NET_RX softirq run on local_bh_enable() */
+	local_bh_disable();
+	napi_schedule(&dhd->rx_napi);
+	local_bh_enable();
+#endif /* DHD_RX_NAPI */
+}
+
 void
 dhd_event(struct dhd_info *dhd, char *evpkt, int evlen, int ifidx)
 {
@@ -2686,6 +2767,15 @@ dhd_attach(osl_t *osh, struct dhd_bus *bus, uint bus_hdrlen)
 		goto fail;
 	dhd_state |= DHD_ATTACH_STATE_ADD_IF;
 
+#ifdef DHD_RX_NAPI
+	/* One NAPI context on the primary interface serves all interfaces */
+	skb_queue_head_init(&dhd->rx_pend_queue);
+	skb_queue_head_init(&dhd->rx_napi_queue);
+	skb_queue_head_init(&dhd->rx_process_queue);
+	netif_napi_add(net, &dhd->rx_napi, dhd_napi_poll, dhd_napi_weight);
+	napi_enable(&dhd->rx_napi);
+#endif /* DHD_RX_NAPI */
+
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 31))
 	net->open = NULL;
 #else
@@ -3739,6 +3829,12 @@ void dhd_detach(dhd_pub_t *dhdp)
 			}
 			dhd_net_if_unlock_local(dhd);
 		}
+#ifdef DHD_RX_NAPI
+		/* Must go before free_netdev() of the primary interface */
+		napi_disable(&dhd->rx_napi);
+		netif_napi_del(&dhd->rx_napi);
+#endif /* DHD_RX_NAPI */
+
 		/*  delete primary interface 0 */
 		ifp = dhd->iflist[0];
 		ASSERT(ifp);
@@ -3780,6 +3876,14 @@ void dhd_detach(dhd_pub_t *dhdp)
 #endif /* DHDTHREAD */
 		tasklet_kill(&dhd->tasklet);
 	}
+#ifdef DHD_RX_NAPI
+	if (dhd->dhd_state & DHD_ATTACH_STATE_ADD_IF) {
+		/* The DPC is stopped, nothing feeds the queues any more */
+		__skb_queue_purge(&dhd->rx_pend_queue);
+		skb_queue_purge(&dhd->rx_napi_queue);
+		__skb_queue_purge(&dhd->rx_process_queue);
+	}
+#endif /* DHD_RX_NAPI */
 	if (dhd->dhd_state & DHD_ATTACH_STATE_PROT_ATTACH) {
 		dhd_bus_detach(dhdp);
 
@@ -83,6 +83,13 @@
 
 #define DHD_TXMINMAX	1	/* Max tx frames if rx still pending */
 
+#define DPC_RXHIST_BINS	8	/* Frames per DPC pass: 0, 1, 2-3, 4-7, ... 64 and more */
+
+#define DHD_DPC_ADAPT	TRUE	/* Default for resizing the bounds per DPC pass */
+#define DHD_DPC_TARGET_US	2000	/* Default for the longest wanted DPC pass */
+#define DHD_BOUND_SCALE	4	/* Adaptive bounds stay within [bound/4, bound*4] */
+#define DPC_TIME_BINS	8	/* DPC pass duration histogram, see dpc_time_bins */
+
 #define MEMBLOCK	2048		/* Block size used for downloading of dongle image */
 #define MAX_NVRAMBUF_SIZE	4096	/* max nvram buf size */
 #define MAX_DATA_BUF	(32 * 1024)	/* Must be large enough to hold biggest possible glom */
@@ -292,6 +299,15 @@ typedef struct dhd_bus {
 	uint		rxglomfail;		/* Failed deglom attempts */
 	uint		rxglomframes;		/* Number of glom frames (superframes) */
 	uint		rxglompkts;		/* Number of packets from glom frames */
+	uint		dpc_rxpasses;		/* DPC passes that read frames */
+	uint		dpc_rxframes;		/* Frames read by those passes */
+	uint		dpc_rxhist[DPC_RXHIST_BINS];	/* Passes by frames read: 0, 1, 2-3.. */
+	uint		rxbound_cur;		/* Adaptive rx frames per DPC pass */
+	uint		txbound_cur;		/* Adaptive tx frames per DPC pass */
+	uint		dpc_timehist[DPC_TIME_BINS];	/* DPC passes by duration */
+	uint32		dpc_time_max;		/* Longest DPC pass (us) */
+	uint		dpc_grow;		/* Number of bound increases */
+	uint		dpc_shrink;		/* Number of bound decreases */
 	uint		f2rxhdrs;		/* Number of header reads */
 	uint		f2rxdata;		/* Number of frame data reads */
 	uint		f2txdata;		/* Number of f2 frame writes */
@@ -327,6 +343,15 @@ uint dhd_txbound;
 uint dhd_rxbound;
 uint dhd_txminmax = DHD_TXMINMAX;
 
+/* Adaptive DPC bounds: dhd_txbound/dhd_rxbound become the nominal values */
+uint dhd_dpc_adapt;
+uint dhd_dpc_target_us;
+
+/* Upper edges (us) of the DPC pass duration histogram bins */
+static const uint32 dpc_time_bins[DPC_TIME_BINS - 1] = {
+	50, 100, 200, 500, 1000, 2000, 5000
+};
+
 /* override the RAM size if possible */
 #define DONGLE_MIN_MEMSIZE (128 *1024)
 int dhd_dongle_memsize;
@@ -1559,6 +1584,8 @@ enum {
 	IOV_SD1IDLE,
 	IOV_SLEEP,
 	IOV_DONGLEISOLATION,
+	IOV_DPCADAPT,
+	IOV_DPCTARGET,
 	IOV_VARS,
 #ifdef SOFTAP
 	IOV_FWPATH
@@ -1602,6 +1629,8 @@ const bcm_iovar_t dhdsdio_iovars[] = {
 	{"pktgen",	IOV_PKTGEN,	0,	IOVT_BUFFER,	sizeof(dhd_pktgen_t) },
 #endif /* SDTEST */
 	{"dngl_isolation", IOV_DONGLEISOLATION,	0,	IOVT_UINT32,	0 },
+	{"dpc_adapt",	IOV_DPCADAPT,	0,	IOVT_BOOL,	0 },
+	{"dpc_target",	IOV_DPCTARGET,	0,	IOVT_UINT32,	0 },
 #ifdef SOFTAP
 	{"fwpath", IOV_FWPATH, 0, IOVT_BUFFER, 0 },
 #endif
@@ -1648,6 +1677,20 @@ dhd_bus_dump(dhd_pub_t *dhdp, struct bcmstrbuf *strbuf)
 	            bus->fc_rcvd, bus->fc_xoff, bus->fc_xon);
 	bcm_bprintf(strbuf, "rxglomfail %d, rxglomframes %d, rxglompkts %d\n",
 	            bus->rxglomfail, bus->rxglomframes, bus->rxglompkts);
+	bcm_bprintf(strbuf, "dpc rx frames 0:%d 1:%d 2-3:%d 4-7:%d 8-15:%d 16-31:%d "
+	            "32-63:%d 64+:%d\n",
+	            bus->dpc_rxhist[0], bus->dpc_rxhist[1], bus->dpc_rxhist[2],
+	            bus->dpc_rxhist[3], bus->dpc_rxhist[4], bus->dpc_rxhist[5],
+	            bus->dpc_rxhist[6], bus->dpc_rxhist[7]);
+	bcm_bprintf(strbuf, "dpc time(us) <50:%d <100:%d <200:%d <500:%d <1000:%d <2000:%d "
+	            "<5000:%d 5000+:%d max %d\n",
+	            bus->dpc_timehist[0], bus->dpc_timehist[1], bus->dpc_timehist[2],
+	            bus->dpc_timehist[3], bus->dpc_timehist[4], bus->dpc_timehist[5],
+	            bus->dpc_timehist[6], bus->dpc_timehist[7], bus->dpc_time_max);
+	bcm_bprintf(strbuf, "dpc bounds rx %d tx %d (nominal %d/%d), adapt %d target %dus, "
+	            "grow %d shrink %d\n",
+	            bus->rxbound_cur, bus->txbound_cur, dhd_rxbound, dhd_txbound,
+	            dhd_dpc_adapt, dhd_dpc_target_us, bus->dpc_grow, bus->dpc_shrink);
 	bcm_bprintf(strbuf, "f2rx (hdrs/data) %d (%d/%d), f2tx %d f1regs %d\n",
 	            (bus->f2rxhdrs + bus->f2rxdata), bus->f2rxhdrs, bus->f2rxdata,
 	            bus->f2txdata, bus->f1regdata);
@@ -1665,6 +1708,11 @@ dhd_bus_dump(dhd_pub_t *dhdp, struct bcmstrbuf *strbuf)
 		dhd_dump_pct(strbuf, ", pkts/glom", bus->rxglompkts, bus->rxglomframes);
 		bcm_bprintf(strbuf, "\n");
 
+		dhd_dump_pct(strbuf, "Rx: frames/dpc", bus->dpc_rxframes, bus->dpc_rxpasses);
+		dhd_dump_pct(strbuf, ", pkts/batch", bus->dhd->rx_packets,
+		             bus->dhd->rx_batches);
+		bcm_bprintf(strbuf, "\n");
+
 		dhd_dump_pct(strbuf, "Tx: pkts/f2wr", bus->dhd->tx_packets, bus->f2txdata);
 		dhd_dump_pct(strbuf, ", pkts/f1sd", bus->dhd->tx_packets, bus->f1regdata);
 		dhd_dump_pct(strbuf, ", pkts/sd", bus->dhd->tx_packets,
@@ -1714,6 +1762,10 @@ dhd_bus_clearcounts(dhd_pub_t *dhdp)
 	bus->rx_hdrfail = bus->rx_badhdr = bus->rx_badseq = 0;
 	bus->tx_sderrs = bus->fc_rcvd = bus->fc_xoff = bus->fc_xon = 0;
 	bus->rxglomfail = bus->rxglomframes = bus->rxglompkts = 0;
+	bus->dpc_rxpasses = bus->dpc_rxframes = 0;
+	bzero(bus->dpc_rxhist, sizeof(bus->dpc_rxhist));
+	bzero(bus->dpc_timehist, sizeof(bus->dpc_timehist));
+	bus->dpc_time_max = bus->dpc_grow = bus->dpc_shrink = 0;
 	bus->f2rxhdrs = bus->f2rxdata = bus->f2txdata = bus->f1regdata = 0;
 }
 
@@ -2625,6 +2677,28 @@ dhdsdio_doiovar(dhd_bus_t *bus, const bcm_iovar_t *vi, uint32 actionid, const ch
 		bus->dhd->dongle_isolation = bool_val;
 		break;
 
+	case IOV_GVAL(IOV_DPCADAPT):
+		int_val = (int32)dhd_dpc_adapt;
+		bcopy(&int_val, arg, val_size);
+		break;
+
+	case IOV_SVAL(IOV_DPCADAPT):
+		dhd_dpc_adapt = bool_val;
+		break;
+
+	case IOV_GVAL(IOV_DPCTARGET):
+		int_val = (int32)dhd_dpc_target_us;
+		bcopy(&int_val, arg, val_size);
+		break;
+
+	case IOV_SVAL(IOV_DPCTARGET):
+		if (int_val <= 0) {
+			bcmerror = BCME_RANGE;
+			break;
+		}
+		dhd_dpc_target_us = (uint)int_val;
+		break;
+
 	case IOV_SVAL(IOV_DEVRESET):
 		DHD_TRACE(("%s: Called set IOV_DEVRESET=%d dongle_reset=%d busstate=%d\n",
 		           __FUNCTION__, bool_val, bus->dhd->dongle_reset,
@@ -4430,6 +4504,75 @@ dhdsdio_hostmail(dhd_bus_t *bus)
 	return intstatus;
 }
 
+/* Keep an adaptive bound within its range around the nominal (module) value */
+static uint
+dhdsdio_bound_clamp(uint cur, uint nominal)
+{
+	uint lo = MAX(nominal / DHD_BOUND_SCALE, 1);
+	uint hi = MAX(nominal * DHD_BOUND_SCALE, 1);
+
+	return MIN(MAX(cur, lo), hi);
+}
+
+/*
+ * Resize the rx/tx bounds after a DPC pass. A pass that ran over the
+ * time target halves both bounds, so other threads get the CPU back
+ * sooner. A pass that used up a bound with work still pending grows
+ * it by half, as long as the longer pass is expected to fit the
+ * target; this saves DPC reschedules under bulk traffic. Bounds that
+ * were not needed decay back towards the nominal value so that the
+ * next burst does not start with an oversized pass.
+ */
+static void
+dhdsdio_dpc_adapt(dhd_bus_t *bus, uint32 elapsed, uint rxcnt, bool rxmore,
+	uint txcnt, uint txbacklog)
+{
+	uint32 target = MAX(dhd_dpc_target_us, 1);
+	uint bin;
+
+	for (bin = 0; bin < DPC_TIME_BINS - 1 && elapsed >= dpc_time_bins[bin]; bin++)
+		;
+	bus->dpc_timehist[bin]++;
+	if (elapsed > bus->dpc_time_max)
+		bus->dpc_time_max = elapsed;
+
+	if (!dhd_dpc_adapt) {
+		bus->rxbound_cur = dhd_rxbound;
+		bus->txbound_cur = dhd_txbound;
+		return;
+	}
+
+	if (elapsed > target) {
+		if (bus->rxbound_cur > 1 || bus->txbound_cur > 1)
+			bus->dpc_shrink++;
+		bus->rxbound_cur /= 2;
+		bus->txbound_cur /= 2;
+	} else {
+		bool room = (elapsed + elapsed / 2) <= target;
+
+		if (rxmore && rxcnt >= bus->rxbound_cur) {
+			if (room) {
+				bus->rxbound_cur += bus->rxbound_cur / 2 + 1;
+				bus->dpc_grow++;
+			}
+		} else if (bus->rxbound_cur > dhd_rxbound) {
+			bus->rxbound_cur -= (bus->rxbound_cur - dhd_rxbound + 3) / 4;
+		}
+
+		if (txbacklog && txcnt >= bus->txbound_cur) {
+			if (room) {
+				bus->txbound_cur += bus->txbound_cur / 2 + 1;
+				bus->dpc_grow++;
+			}
+		} else if (bus->txbound_cur > dhd_txbound) {
+			bus->txbound_cur -= (bus->txbound_cur - dhd_txbound + 3) / 4;
+		}
+	}
+
+	bus->rxbound_cur = dhdsdio_bound_clamp(bus->rxbound_cur, dhd_rxbound);
+	bus->txbound_cur = dhdsdio_bound_clamp(bus->txbound_cur, dhd_txbound);
+}
+
 static bool
 dhdsdio_dpc(dhd_bus_t *bus)
 {
@@ -4440,6 +4583,10 @@ dhdsdio_dpc(dhd_bus_t *bus)
 	uint rxlimit = dhd_rxbound; /* Rx frames to read before resched */
 	uint txlimit = dhd_txbound; /* Tx frames to send before resched */
 	uint framecnt = 0;		  /* Temporary counter of tx/rx frames */
+	uint rxcnt = 0, txcnt = 0;	  /* Frames moved in this pass */
+	uint txbacklog = 0;		  /* Tx frames still queued after this pass */
+	uint32 start = OSL_SYSUPTIME_US();
+	uint32 elapsed;			  /* Bus time of this pass, stack excluded */
 	bool rxdone = TRUE;		  /* Flag for no more read data */
 	bool resched = FALSE;	  /* Flag indicating resched wanted */
 
@@ -4451,6 +4598,11 @@ dhdsdio_dpc(dhd_bus_t *bus)
 		return 0;
 	}
 
+	if (dhd_dpc_adapt) {
+		rxlimit = bus->rxbound_cur;
+		txlimit = bus->txbound_cur;
+	}
+
 	/* Start with leftover status bits */
 	intstatus = bus->intstatus;
 
@@ -4585,10 +4737,19 @@ dhdsdio_dpc(dhd_bus_t *bus)
 
 	/* On frame indication, read available frames */
 	if (PKT_AVAILABLE(bus, intstatus)) {
+		uint bin;
+
 		framecnt = dhdsdio_readframes(bus, rxlimit, &rxdone);
 		if (rxdone || bus->rxskip)
 			intstatus  &= ~FRAME_AVAIL_MASK(bus);
-		rxlimit -= MIN(framecnt, rxlimit);
+		rxcnt = MIN(framecnt, rxlimit);
+		rxlimit -= rxcnt;
+
+		for (bin = 0; bin < DPC_RXHIST_BINS - 1 && (1 << bin) <= framecnt; bin++)
+			;
+		bus->dpc_rxhist[bin]++;
+		bus->dpc_rxpasses++;
+		bus->dpc_rxframes += framecnt;
 	}
 
 	/* Keep still-pending events for next scheduling */
@@ -4677,6 +4838,7 @@ clkwait:
 		framecnt = rxdone ? txlimit : MIN(txlimit, dhd_txminmax);
 		framecnt = dhdsdio_sendfromq(bus, framecnt);
 		txlimit -= framecnt;
+		txcnt = framecnt;
 	}
 	/* Resched the DPC if ctrl cmd is pending on bus credit */
 	if (bus->ctrl_frame_stat)
@@ -4698,6 +4860,8 @@ clkwait:
 	}
 
 	bus->dpc_sched = resched;
+	if (DATAOK(bus))
+		txbacklog = pktq_mlen(&bus->txq, ~bus->flowcontrol);
 
 	/* If we're done for now, turn off clock request. */
 	if ((bus->idletime == DHD_IDLE_IMMEDIATE) && (bus->clkstate != CLK_PENDING)) {
@@ -4705,7 +4869,16 @@ clkwait:
 		dhdsdio_clkctl(bus, CLK_NONE, FALSE);
 	}
 
+	/* Sampled before the flush, which may run the whole rx stack inline */
+	elapsed = OSL_SYSUPTIME_US() - start;
+
 	dhd_os_sdunlock(bus->dhd);
+
+	/* Hand everything read in this pass to the network stack at once */
+	dhd_os_rxflush(bus->dhd);
+
+	dhdsdio_dpc_adapt(bus, elapsed, rxcnt, !rxdone, txcnt, txbacklog);
+
 	return resched;
 }
 
@@ -5283,6 +5456,8 @@ dhdsdio_probe(uint16 venid, uint16 devid, uint16 bus_no, uint16 slot,
 	dhd_doflow = FALSE;
 	dhd_dongle_memsize = 0;
 	dhd_txminmax = DHD_TXMINMAX;
+	dhd_dpc_adapt = DHD_DPC_ADAPT;
+	dhd_dpc_target_us = DHD_DPC_TARGET_US;
 
 	forcealign = TRUE;
 
@@ -5663,6 +5838,8 @@ dhdsdio_probe_init(dhd_bus_t *bus, osl_t *osh, void *sdh)
 	bus->sleeping = FALSE;
 	bus->rxflow = FALSE;
 	bus->prev_rxlim_hit = 0;
+	bus->rxbound_cur = dhd_rxbound;
+	bus->txbound_cur = dhd_txbound;
 
 
 	/* Done with backplane-dependent accesses, can drop clock... */
@@ -63,4 +63,8 @@ typedef void (*pktfree_cb_fn_t)(void *ctx, void *pkt, unsigned int status);
 #define OSL_SYSUPTIME_SUPPORT TRUE
 #endif 
 
+#if !defined(OSL_SYSUPTIME_US)
+#define OSL_SYSUPTIME_US() (0)
+#endif 
+
 #endif	
@@ -34,6 +34,7 @@
 #include <osl.h>
 #include <bcmutils.h>
 #include <linux/delay.h>
+#include <linux/ktime.h>
 #include <pcicfg.h>
 
 #ifdef BCMASSERT_LOG
@@ -708,6 +709,13 @@ osl_pcmcia_write_attr(osl_t *osh, uint offset, void *buf, int size)
 	osl_pcmcia_attr(osh, offset, (char *) buf, size, TRUE);
 }
 
+uint32
+osl_sysuptime_us(void)
+{
+	/* Wraps after ~71 minutes, callers only take differences */
+	return (uint32)ktime_to_us(ktime_get());
+}
+
 void *
 osl_malloc(osl_t *osh, uint size)
 {
@@ -19,6 +19,8 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -37,6 +39,16 @@
 
 #include "binder.h"
 
+/*
+ * binder_lock still protects nodes, refs, threads, transaction stacks and
+ * the todo lists of every proc, so unrelated procs keep serialising on it
+ * for everything but buffers. Only each proc's buffer allocator has its
+ * own alloc_lock, taken after binder_lock when both are needed, so that a
+ * sender can allocate and fill a buffer in the target without holding
+ * binder_lock. Per-proc locks for the todo lists would also have to cover
+ * the transaction stacks and nodes that a transaction updates in both the
+ * sender and the target at once; that split has not been done.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
@@ -106,6 +118,19 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/*
+ * Pages mapped when a proc mmaps binder and kept until it goes away, so
+ * that small transactions never allocate or map pages.
+ */
+static unsigned int binder_prefault_pages = 4;
+module_param_named(prefault_pages, binder_prefault_pages, uint,
+		   S_IWUSR | S_IRUGO);
+
+/* Unused pages each proc keeps mapped after freeing buffers */
+static unsigned int binder_max_free_pages = 16;
+module_param_named(max_free_pages, binder_max_free_pages, uint,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -121,6 +146,11 @@ static int binder_set_stop_on_user_error(const char *val,
 module_param_call(stop_on_user_error, binder_set_stop_on_user_error,
 	param_get_int, &binder_stop_on_user_error, S_IWUSR | S_IRUGO);
 
+static int binder_latency_stats;
+static int binder_set_latency_stats(const char *val, struct kernel_param *kp);
+module_param_call(latency_stats, binder_set_latency_stats,
+	param_get_int, &binder_latency_stats, S_IWUSR | S_IRUGO);
+
 #define binder_debug(mask, x...) \
 	do { \
 		if (binder_debug_mask & mask) \
@@ -155,6 +185,29 @@ struct binder_stats {
 
 static struct binder_stats binder_stats;
 
+/*
+ * Latency histograms, collected only while the latency_stats parameter
+ * is set. Bucket 0 counts samples under 1us, bucket n those from
+ * 2^(n-1)us up to 2^n us, and the last bucket everything above.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency {
+	unsigned long transactions;
+	u64 bytes;
+	/* binder_transaction() to BR_TRANSACTION read by the target */
+	unsigned int deliver[BINDER_LATENCY_BUCKETS];
+	/* binder_transaction() to BC_REPLY from the target */
+	unsigned int reply[BINDER_LATENCY_BUCKETS];
+};
+
+/* Per node, allocated on first use and shared with its transactions */
+struct binder_node_latency {
+	struct kref kref;
+	struct binder_latency lat;
+};
+static void binder_node_latency_put(struct binder_node_latency *latency);
+
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
 	binder_stats.obj_deleted[type]++;
@@ -223,6 +276,7 @@ struct binder_node {
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
+	int tmp_refs;
 	void __user *ptr;
 	void __user *cookie;
 	unsigned has_strong_ref:1;
@@ -233,6 +287,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_node_latency *latency;
 };
 
 struct binder_ref_death {
@@ -295,12 +350,19 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/* protects buffers, free/allocated_buffers, free_async_space, pages */
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	/* the first prefault_pages pages are mapped for the life of proc */
+	size_t prefault_pages;
+	/* mapped pages outside any buffer, at most max_free_pages of them */
+	size_t free_pages;
+	size_t max_free_pages;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -313,6 +375,14 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	/*
+	 * Senders filling a buffer in this proc without binder_lock hold a
+	 * temporary reference, and the buffers and the proc itself are only
+	 * freed once the last one is dropped after release.
+	 */
+	int tmp_refs;
+	unsigned dead:1;
+	struct binder_latency latency;
 };
 
 enum {
@@ -356,6 +426,9 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	/* set by binder_transaction() only while collecting latency stats */
+	ktime_t	start;
+	struct binder_node_latency *latency;
 };
 
 static void
@@ -584,16 +657,22 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
+/*
+ * Only binder_lock holders free allocated buffers, so the result stays
+ * valid after alloc_lock is dropped as long as the caller holds it.
+ */
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
+	struct rb_node *n;
 	struct binder_buffer *buffer;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	mutex_lock(&proc->alloc_lock);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -603,9 +682,29 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
 		else
-			return buffer;
+			break;
+	}
+	mutex_unlock(&proc->alloc_lock);
+	return n ? buffer : NULL;
+}
+
+/*
+ * Take pages that are still mapped back into use. Their contents are
+ * left over from earlier buffers of the same proc, which has already
+ * seen them.
+ */
+static void binder_reuse_page_range(struct binder_proc *proc,
+				    void *start, void *end)
+{
+	void *page_addr;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		if ((page_addr - proc->buffer) / PAGE_SIZE <
+		    proc->prefault_pages)
+			continue;
+		BUG_ON(!proc->free_pages);
+		proc->free_pages--;
 	}
-	return NULL;
 }
 
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
@@ -617,6 +716,8 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	struct vm_struct tmp_area;
 	struct page **page;
 	struct mm_struct *mm;
+	/* pages this call allocated, as opposed to reused, by offset */
+	DECLARE_BITMAP(new_pages, SZ_4M / PAGE_SIZE);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -625,6 +726,21 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	/* pages kept mapped by binder_release_page_range are reused as is */
+	if (allocate) {
+		for (page_addr = start; page_addr < end;
+		     page_addr += PAGE_SIZE) {
+			page = &proc->pages[(page_addr - proc->buffer) /
+					    PAGE_SIZE];
+			if (*page == NULL)
+				break;
+		}
+		if (page_addr >= end) {
+			binder_reuse_page_range(proc, start, end);
+			return 0;
+		}
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -644,18 +760,24 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
+	bitmap_zero(new_pages, SZ_4M / PAGE_SIZE);
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
+		if (*page) {
+			binder_reuse_page_range(proc, page_addr,
+						page_addr + PAGE_SIZE);
+			continue;
+		}
 		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
+		__set_bit((page_addr - start) / PAGE_SIZE, new_pages);
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
 		page_array_ptr = page;
@@ -690,13 +812,37 @@ free_range:
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
 		__free_page(*page);
 		*page = NULL;
+	}
+	goto err_no_vma;
+
+err_vm_insert_page_failed:
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+err_map_kernel_failed:
+	__free_page(*page);
+	*page = NULL;
 err_alloc_page_failed:
-		;
+	/*
+	 * Undo only what this call did below the failing page: free the
+	 * pages it allocated and hand the ones it reused back to the
+	 * lazily freed pool. Prefaulted and kept pages stay mapped.
+	 */
+	while (page_addr > start) {
+		page_addr -= PAGE_SIZE;
+		if (!test_bit((page_addr - start) / PAGE_SIZE, new_pages)) {
+			if ((page_addr - proc->buffer) / PAGE_SIZE >=
+			    proc->prefault_pages)
+				proc->free_pages++;
+			continue;
+		}
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		zap_page_range(vma, (uintptr_t)page_addr +
+			       proc->user_buffer_offset, PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(*page);
+		*page = NULL;
 	}
 err_no_vma:
 	if (mm) {
@@ -706,9 +852,31 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Called for pages no longer covered by any buffer. Up to max_free_pages
+ * of them stay mapped for the next allocation, prefaulted pages always
+ * do; only the rest is unmapped and freed.
+ */
+static void binder_release_page_range(struct binder_proc *proc,
+				      void *start, void *end)
+{
+	void *page_addr;
+
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		if ((page_addr - proc->buffer) / PAGE_SIZE <
+		    proc->prefault_pages)
+			continue;
+		if (proc->free_pages >= proc->max_free_pages)
+			break;
+		proc->free_pages++;
+	}
+	binder_update_page_range(proc, 0, page_addr, end, NULL);
+}
+
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -801,6 +969,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
+	buffer->transaction = NULL;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -812,6 +982,21 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/* Does not need binder_lock, the caller must keep proc alive */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 is_async);
+	mutex_unlock(&proc->alloc_lock);
+
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -862,15 +1047,15 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 			     "not share page%s%s with with %p or %p\n",
 			     proc->pid, buffer, free_page_start ? "" : " end",
 			     free_page_end ? "" : " start", prev, next);
-		binder_update_page_range(proc, 0, free_page_start ?
+		binder_release_page_range(proc, free_page_start ?
 			buffer_start_page(buffer) : buffer_end_page(buffer),
 			(free_page_end ? buffer_end_page(buffer) :
-			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+			buffer_start_page(buffer)) + PAGE_SIZE);
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -898,10 +1083,9 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
+	binder_release_page_range(proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK));
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
@@ -924,6 +1108,14 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	binder_free_buf_locked(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1040,7 +1232,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 		}
 	} else {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
+		    !node->local_weak_refs && !node->tmp_refs) {
 			list_del_init(&node->work.entry);
 			if (node->proc) {
 				rb_erase(&node->rb_node, &node->proc->nodes);
@@ -1053,6 +1245,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
+			binder_node_latency_put(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1229,6 +1422,63 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+static void binder_node_latency_release(struct kref *kref)
+{
+	kfree(container_of(kref, struct binder_node_latency, kref));
+}
+
+static void binder_node_latency_put(struct binder_node_latency *latency)
+{
+	if (latency)
+		kref_put(&latency->kref, binder_node_latency_release);
+}
+
+static struct binder_node_latency *
+binder_node_latency_get(struct binder_node *node)
+{
+	if (node->latency == NULL) {
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+		if (node->latency == NULL)
+			return NULL;
+		kref_init(&node->latency->kref);
+	}
+	kref_get(&node->latency->kref);
+	return node->latency;
+}
+
+static void binder_latency_add(unsigned int *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = us > 0 ? fls(min_t(s64, us, INT_MAX)) : 0;
+
+	hist[min(bucket, BINDER_LATENCY_BUCKETS - 1)]++;
+}
+
+/* Caller holds binder_lock */
+static void binder_latency_deliver(struct binder_proc *proc,
+				   struct binder_transaction *t)
+{
+	size_t bytes = t->buffer->data_size + t->buffer->offsets_size;
+
+	proc->latency.transactions++;
+	proc->latency.bytes += bytes;
+	binder_latency_add(proc->latency.deliver, t->start);
+	if (t->latency) {
+		t->latency->lat.transactions++;
+		t->latency->lat.bytes += bytes;
+		binder_latency_add(t->latency->lat.deliver, t->start);
+	}
+}
+
+/* Caller holds binder_lock */
+static void binder_latency_reply(struct binder_proc *proc,
+				 struct binder_transaction *t)
+{
+	binder_latency_add(proc->latency.reply, t->start);
+	if (t->latency)
+		binder_latency_add(t->latency->lat.reply, t->start);
+}
+
 static void binder_pop_transaction(struct binder_thread *target_thread,
 				   struct binder_transaction *t)
 {
@@ -1242,6 +1492,7 @@ static void binder_pop_transaction(struct binder_thread *target_thread,
 	t->need_reply = 0;
 	if (t->buffer)
 		t->buffer->transaction = NULL;
+	binder_node_latency_put(t->latency);
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
@@ -1376,13 +1627,43 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+static void binder_free_proc(struct binder_proc *proc);
+
+/* Caller holds binder_lock */
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	if (--proc->tmp_refs == 0 && proc->dead)
+		binder_free_proc(proc);
+}
+
+/*
+ * A live node is kept by the strong ref taken along with the tmp ref; a
+ * node whose proc died meanwhile is freed here once nothing refers to it.
+ * Caller holds binder_lock.
+ */
+static void binder_node_dec_tmpref(struct binder_node *node)
+{
+	if (--node->tmp_refs || node->proc)
+		return;
+	if (hlist_empty(&node->refs) && !node->local_strong_refs &&
+	    !node->local_weak_refs) {
+		hlist_del(&node->dead_node);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: dead node %d deleted\n",
+			     node->debug_id);
+		binder_node_latency_put(node->latency);
+		kfree(node);
+		binder_stats_deleted(BINDER_STAT_NODE);
+	}
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
-	size_t *offp, *off_end;
+	size_t *offp = NULL, *off_end;
 	struct binder_proc *target_proc;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
@@ -1548,33 +1829,90 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
-		return_error = BR_FAILED_REPLY;
-		goto err_binder_alloc_buf_failed;
+	if (binder_latency_stats && !reply) {
+		t->start = ktime_get();
+		if (target_node)
+			t->latency = binder_node_latency_get(target_node);
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
-	if (target_node)
+
+	/*
+	 * The buffer is private to this transaction until it is queued, so
+	 * it is allocated and filled without binder_lock: tmp_refs keeps
+	 * target_proc and target_node around, the strong ref on target_node
+	 * is the one the buffer holds once queued.
+	 */
+	if (target_node) {
 		binder_inc_node(target_node, 1, 0, NULL);
+		target_node->tmp_refs++;
+	}
+	target_proc->tmp_refs++;
+	return_error = BR_OK;
+	mutex_unlock(&binder_lock);
 
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
+	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (t->buffer) {
+		t->buffer->debug_id = t->debug_id;
+		t->buffer->transaction = t;
+		t->buffer->target_node = target_node;
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+		offp = (size_t *)(t->buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+
+		if (copy_from_user(t->buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n", proc->pid,
+				thread->pid);
+			return_error = BR_FAILED_REPLY;
+		}
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
+
+	mutex_lock(&binder_lock);
+	if (target_proc->dead) {
+		return_error = BR_DEAD_REPLY;
+		goto err_target_proc_dead;
+	}
+	/* target_proc is alive, so its node is still held by our strong ref */
+	if (target_node)
+		binder_node_dec_tmpref(target_node);
+	if (t->buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
+		goto err_binder_alloc_buf_failed;
+	}
+	if (return_error != BR_OK)
 		goto err_copy_data_failed;
+
+	/* the thread we are talking to may have exited meanwhile */
+	if (reply) {
+		if (in_reply_to->from != target_thread ||
+		    target_thread->transaction_stack != in_reply_to) {
+			return_error = BR_DEAD_REPLY;
+			goto err_copy_data_failed;
+		}
+	} else if (target_thread) {
+		struct binder_transaction *tmp;
+
+		target_thread = NULL;
+		for (tmp = thread->transaction_stack; tmp;
+		     tmp = tmp->from_parent)
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+		t->to_thread = target_thread;
+		if (target_thread) {
+			target_list = &target_thread->todo;
+			target_wait = &target_thread->wait;
+		} else {
+			target_list = &target_proc->todo;
+			target_wait = &target_proc->wait;
+		}
 	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1735,6 +2073,8 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		if (in_reply_to->start.tv64)
+			binder_latency_reply(proc, in_reply_to);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1756,6 +2096,7 @@ static void binder_transaction(struct binder_proc *proc,
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1770,10 +2111,28 @@ err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
+	goto err_put_target_proc;
 err_binder_alloc_buf_failed:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+	goto err_put_target_proc;
+err_target_proc_dead:
+	/*
+	 * Releasing target_proc dropped the local refs of its nodes, our
+	 * strong ref included: only the tmp ref is left to put.
+	 */
+	if (target_node)
+		binder_node_dec_tmpref(target_node);
+	if (t->buffer) {
+		t->buffer->transaction = NULL;
+		binder_free_buf(target_proc, t->buffer);
+	}
+err_put_target_proc:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
+	binder_node_latency_put(t->latency);
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 err_alloc_t_failed:
@@ -2370,6 +2729,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
+					binder_node_latency_put(node->latency);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2465,6 +2825,8 @@ retry:
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
+		if (cmd == BR_TRANSACTION && t->start.tv64)
+			binder_latency_deliver(proc, t);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
 			     "size %zd-%zd ptr %p-%p\n",
@@ -2484,6 +2846,7 @@ retry:
 			thread->transaction_stack = t;
 		} else {
 			t->buffer->transaction = NULL;
+			binder_node_latency_put(t->latency);
 			kfree(t);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION);
 		}
@@ -2858,7 +3221,11 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
 
-	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
+	proc->prefault_pages = min_t(size_t, max(binder_prefault_pages, 1U),
+				     proc->buffer_size / PAGE_SIZE);
+	proc->max_free_pages = binder_max_free_pages;
+	if (binder_update_page_range(proc, 1, proc->buffer,
+	    proc->buffer + proc->prefault_pages * PAGE_SIZE, vma)) {
 		ret = -ENOMEM;
 		failure_string = "alloc small buf";
 		goto err_alloc_small_buf_failed;
@@ -2905,6 +3272,7 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
@@ -2964,9 +3332,8 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2994,7 +3361,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 		nodes++;
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
-		if (hlist_empty(&node->refs)) {
+		if (hlist_empty(&node->refs) && !node->tmp_refs) {
+			binder_node_latency_put(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -3032,8 +3400,29 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
 
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d threads %d, nodes %d (ref %d), "
+		     "refs %d, active transactions %d\n",
+		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
+		     active_transactions);
+
+	proc->dead = 1;
+	if (!proc->tmp_refs)
+		binder_free_proc(proc);
+}
+
+/*
+ * Free the buffers of a released proc, and the proc itself, once no
+ * sender is still filling a buffer in it. Caller holds binder_lock.
+ */
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
 	while ((n = rb_first(&proc->allocated_buffers))) {
 		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
 							rb_node);
@@ -3076,11 +3465,8 @@ static void binder_deferred_release(struct binder_proc *proc)
 	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
-		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
-		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
 
 	kfree(proc);
 }
@@ -3117,7 +3503,7 @@ static void binder_deferred_func(struct work_struct *work)
 			binder_deferred_flush(proc);
 
 		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+			binder_deferred_release(proc); /* may free proc */
 
 		mutex_unlock(&binder_lock);
 		if (files)
@@ -3300,9 +3686,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3432,9 +3820,13 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->alloc_lock);
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  pages: %zu prefaulted, %zu free\n",
+		   proc->prefault_pages, proc->free_pages);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3568,10 +3960,93 @@ static struct miscdevice binder_miscdev = {
 	.fops = &binder_fops
 };
 
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency *lat)
+{
+	int i;
+
+	seq_printf(m, "%stransactions: %lu bytes: %llu\n%sdeliver:",
+		   prefix, lat->transactions,
+		   (unsigned long long)lat->bytes, prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %u", lat->deliver[i]);
+	seq_printf(m, "\n%sreply:", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %u", lat->reply[i]);
+	seq_puts(m, "\n");
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+	int i;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+
+	seq_puts(m, "binder latency (us): <1");
+	for (i = 1; i < BINDER_LATENCY_BUCKETS - 1; i++)
+		seq_printf(m, " <%u", 1U << i);
+	seq_printf(m, " >=%u\n", 1U << (BINDER_LATENCY_BUCKETS - 2));
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (!proc->latency.transactions)
+			continue;
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency(m, "  ", &proc->latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+					struct binder_node, rb_node);
+
+			if (!node->latency || !node->latency->lat.transactions)
+				continue;
+			seq_printf(m, "  node %d: u%p c%p\n", node->debug_id,
+				   node->ptr, node->cookie);
+			print_binder_latency(m, "    ", &node->latency->lat);
+		}
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
+/* Turning collection on clears what was gathered before */
+static int binder_set_latency_stats(const char *val, struct kernel_param *kp)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int ret;
+
+	mutex_lock(&binder_lock);
+	ret = param_set_int(val, kp);
+	if (ret || !binder_latency_stats)
+		goto out;
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		memset(&proc->latency, 0, sizeof(proc->latency));
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+					struct binder_node, rb_node);
+
+			if (node->latency)
+				memset(&node->latency->lat, 0,
+				       sizeof(node->latency->lat));
+		}
+	}
+out:
+	mutex_unlock(&binder_lock);
+	return ret;
+}
+
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(latency);
 
 static int __init binder_init(void)
 {
@@ -3612,6 +4087,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 	}
 	return ret;
 }
@@ -28,26 +28,44 @@
 #include <linux/slab.h>
 #include <linux/time.h>
 #include <linux/vmalloc.h>
+#include <linux/mm.h>
 #include <linux/aio.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
 
+/*
+ * Readers are not woken for every entry: they are woken once
+ * LOGGER_WAKE_BYTES(log) bytes have been committed, or LOGGER_WAKE_DELAY
+ * after the first entry of a batch, whichever comes first.
+ */
+#define LOGGER_WAKE_BYTES(log)	((log)->size / 8)
+#define LOGGER_WAKE_DELAY	msecs_to_jiffies(10)
+
 /**
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  * @buffer:	The actual ring buffer
  * @misc:	The "misc" device representing the log
  * @wq:		The wait queue for @readers
  * @readers:	This log's readers
- * @mutex:	The mutex that protects the @buffer
- * @w_off:	The current write head offset
+ * @mutex:	The mutex that serializes readers and ioctls
+ * @lock:	The spinlock that protects the offsets, @readers and @pending
+ * @w_off:	The current write head offset, up to which entries are complete
+ * @w_head:	The reservation head, where the next writer will write
+ * @pending:	Reservations not yet visible to readers, oldest first
+ * @room_wq:	Writers waiting for reservations to be committed
+ * @wake_bytes:	Bytes committed since readers were last woken
+ * @wake_timer:	Wakes readers for a batch that stays below the threshold
  * @head:	The head, or location that readers start reading at.
  * @size:	The size of the log
  * @logs:	The list of log channels
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting. Writers only take 'lock' to
+ * reserve room for an entry and to commit it, and copy the entry in
+ * between without holding any lock.
  */
 struct logger_log {
 	unsigned char		*buffer;
@@ -55,12 +73,34 @@ struct logger_log {
 	wait_queue_head_t	wq;
 	struct list_head	readers;
 	struct mutex		mutex;
+	spinlock_t		lock;
 	size_t			w_off;
+	size_t			w_head;
+	struct list_head	pending;
+	wait_queue_head_t	room_wq;
+	atomic_t		wake_bytes;
+	struct timer_list	wake_timer;
 	size_t			head;
 	size_t			size;
 	struct list_head	logs;
 };
 
+/**
+ * struct logger_reservation - room reserved in a log by one writer
+ * @list:	The associated entry in @logger_log's pending list
+ * @off:	Offset of the entry header
+ * @len:	Length of the entry, header included
+ * @done:	The entry has been written in full
+ *
+ * Lives on the writer's stack from reservation to commit.
+ */
+struct logger_reservation {
+	struct list_head	list;
+	size_t			off;
+	size_t			len;
+	bool			done;
+};
+
 static LIST_HEAD(log_list);
 
 
@@ -71,9 +111,11 @@ static LIST_HEAD(log_list);
  * @r_off:	The current read head offset.
  * @r_all:	Reader can read all entries
  * @r_ver:	Reader ABI version
+ * @r_seq:	Number of times writers pulled @r_off forward
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->mutex, and
+ * @r_off also by log->lock, as writers pull it forward when lapping.
  */
 struct logger_reader {
 	struct logger_log	*log;
@@ -81,6 +123,7 @@ struct logger_reader {
 	size_t			r_off;
 	bool			r_all;
 	int			r_ver;
+	unsigned int		r_seq;
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -142,7 +185,7 @@ static struct logger_entry *get_entry_header(struct logger_log *log,
  * In the log, the length does not include the size of the log entry structure.
  * This function returns the size including the log entry structure.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_msg_len(struct logger_log *log, size_t off)
 {
@@ -186,33 +229,33 @@ static ssize_t copy_header_to_user(int ver, struct logger_entry *entry,
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log_to_user - reads exactly 'count' bytes of the entry at 'off',
+ * whose header is 'entry', from 'log' into the user-space buffer 'buf'.
+ * Returns 'count' on success, or 0 if a writer lapped the reader while the
+ * entry was being copied, in which case the caller should start over.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->mutex, but not log->lock.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
+				   struct logger_entry *entry, size_t off,
 				   char __user *buf,
 				   size_t count)
 {
-	struct logger_entry scratch;
-	struct logger_entry *entry;
 	size_t len;
 	size_t msg_start;
+	bool lapped;
 
 	/*
 	 * First, copy the header to userspace, using the version of
 	 * the header requested
 	 */
-	entry = get_entry_header(log, reader->r_off, &scratch);
 	if (copy_header_to_user(reader->r_ver, entry, buf))
 		return -EFAULT;
 
 	count -= get_user_hdr_len(reader->r_ver);
 	buf += get_user_hdr_len(reader->r_ver);
-	msg_start = logger_offset(log,
-		reader->r_off + sizeof(struct logger_entry));
+	msg_start = logger_offset(log, off + sizeof(struct logger_entry));
 
 	/*
 	 * We read from the msg in two disjoint operations. First, we read from
@@ -231,15 +274,28 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(log, reader->r_off +
-		sizeof(struct logger_entry) + count);
-
+	/*
+	 * A writer reserving room over this entry would have pulled r_off
+	 * forward before touching it, so an unchanged r_off means what we
+	 * copied is intact.
+	 */
+	spin_lock(&log->lock);
+	lapped = reader->r_off != off;
+	if (!lapped)
+		reader->r_off = logger_offset(log, off +
+			sizeof(struct logger_entry) + count);
+	spin_unlock(&log->lock);
+
+	if (lapped)
+		return 0;
 	return count + get_user_hdr_len(reader->r_ver);
 }
 
 /*
  * get_next_entry_by_uid - Starting at 'off', returns an offset into
  * 'log->buffer' which contains the first entry readable by 'euid'
+ *
+ * Caller needs to hold log->lock.
  */
 static size_t get_next_entry_by_uid(struct logger_log *log,
 		size_t off, uid_t euid)
@@ -278,6 +334,9 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	struct logger_entry scratch;
+	struct logger_entry entry;
+	size_t off;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
@@ -287,7 +346,9 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
+		spin_lock(&log->lock);
 		ret = (log->w_off == reader->r_off);
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 		if (!ret)
 			break;
@@ -310,6 +371,7 @@ start:
 		return ret;
 
 	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
@@ -317,20 +379,29 @@ start:
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 		goto start;
 	}
 
+	/* the header may be overwritten once we drop the lock */
+	off = reader->r_off;
+	entry = *get_entry_header(log, off, &scratch);
+	spin_unlock(&log->lock);
+
 	/* get the size of the next entry */
-	ret = get_user_hdr_len(reader->r_ver) +
-		get_entry_msg_len(log, reader->r_off);
+	ret = get_user_hdr_len(reader->r_ver) + entry.len;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
 	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	ret = do_read_log_to_user(log, reader, &entry, off, buf, ret);
+	if (unlikely(!ret)) {
+		mutex_unlock(&log->mutex);
+		goto start;
+	}
 
 out:
 	mutex_unlock(&log->mutex);
@@ -342,7 +413,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -391,13 +462,16 @@ static inline int is_between(size_t a, size_t b, size_t c)
  * fix_up_readers - walk the list of all readers and "fix up" any who were
  * lapped by the writer; also do the same for the default "start head".
  * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
+ * entry after the new reservation head.
+ *
+ * Readers never get past w_off, and room is only reserved past w_head, so
+ * the entries walked here are all complete ones.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
-	size_t old = log->w_off;
+	size_t old = log->w_head;
 	size_t new = logger_offset(log, old + len);
 	struct logger_reader *reader;
 
@@ -405,73 +479,188 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 		log->head = get_next_entry(log, log->head, len);
 
 	list_for_each_entry(reader, &log->readers, list)
-		if (is_between(old, new, reader->r_off))
+		if (is_between(old, new, reader->r_off)) {
 			reader->r_off = get_next_entry(log, reader->r_off, len);
+			reader->r_seq++;
+		}
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * logger_room - can 'len' more bytes be reserved without the reservation
+ * head catching up with entries that are still being written?
  *
- * The caller needs to hold log->mutex.
+ * One maximum sized entry is kept as slack, so that fix_up_readers() never
+ * has to walk into a reservation.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static bool logger_room(struct logger_log *log, size_t len)
+{
+	size_t busy = logger_offset(log, log->w_head - log->w_off);
+
+	return busy + len + sizeof(struct logger_entry) +
+		LOGGER_ENTRY_MAX_PAYLOAD <= log->size;
+}
+
+/*
+ * logger_reserve - reserve 'res->len' bytes at the reservation head. The
+ * room is the caller's until it calls logger_commit().
+ *
+ * Only sleeps if so many writers are in flight at once that the log is
+ * nearly covered by reservations.
+ */
+static void logger_reserve(struct logger_log *log,
+			   struct logger_reservation *res)
+{
+	spin_lock(&log->lock);
+	while (unlikely(!logger_room(log, res->len))) {
+		spin_unlock(&log->lock);
+		wait_event(log->room_wq, logger_room(log, res->len));
+		spin_lock(&log->lock);
+	}
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new reservation head, before we
+	 * write anything over them.
+	 */
+	fix_up_readers(log, res->len);
+
+	res->off = log->w_head;
+	res->done = false;
+	list_add_tail(&res->list, &log->pending);
+	log->w_head = logger_offset(log, log->w_head + res->len);
+	spin_unlock(&log->lock);
+}
+
+/*
+ * logger_wake_readers - wake readers once enough has been committed since
+ * they were last woken, otherwise make sure the batch timer will.
+ */
+static void logger_wake_readers(struct logger_log *log, size_t len)
+{
+	smp_mb();
+	if (!waitqueue_active(&log->wq)) {
+		atomic_set(&log->wake_bytes, 0);
+		return;
+	}
+
+	if (atomic_add_return(len, &log->wake_bytes) >=
+			LOGGER_WAKE_BYTES(log)) {
+		atomic_set(&log->wake_bytes, 0);
+		wake_up_interruptible(&log->wq);
+	} else if (!timer_pending(&log->wake_timer))
+		mod_timer(&log->wake_timer, jiffies + LOGGER_WAKE_DELAY);
+}
+
+static void logger_wake_timer(unsigned long data)
+{
+	struct logger_log *log = (struct logger_log *) data;
+
+	atomic_set(&log->wake_bytes, 0);
+	wake_up_interruptible(&log->wq);
+}
+
+/*
+ * logger_commit - mark the entry in 'res' as complete. Entries become
+ * visible to readers in reservation order, so w_off only moves over the
+ * oldest pending reservations once they are all done.
+ */
+static void logger_commit(struct logger_log *log,
+			  struct logger_reservation *res)
+{
+	struct logger_reservation *first;
+	size_t old_off, new_off;
+
+	/* the entry must be in memory before w_off says it is there */
+	smp_wmb();
+
+	spin_lock(&log->lock);
+	old_off = log->w_off;
+	res->done = true;
+	while (!list_empty(&log->pending)) {
+		first = list_first_entry(&log->pending,
+				struct logger_reservation, list);
+		if (!first->done)
+			break;
+		log->w_off = logger_offset(log, first->off + first->len);
+		list_del(&first->list);
+	}
+	new_off = log->w_off;
+	spin_unlock(&log->lock);
+
+	if (new_off != old_off) {
+		wake_up(&log->room_wq);
+		logger_wake_readers(log, logger_offset(log, new_off - old_off));
+	}
+}
+
+/*
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at 'off'.
+ * Returns the offset following them.
+ */
+static size_t do_write_log(struct logger_log *log, size_t off,
+			   const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
 
-	log->w_off = logger_offset(log, log->w_off + count);
-
+	return logger_offset(log, off + count);
 }
 
 /*
  * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * the log 'log' at 'off', which must be within a reservation of the caller.
  *
  * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
 				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
 		if (copy_from_user(log->buffer, buf + len, count - len))
-			/*
-			 * Note that by not updating w_off, this abandons the
-			 * portion of the new entry that *was* successfully
-			 * copied, just above.  This is intentional to avoid
-			 * message corruption from missing fragments.
-			 */
 			return -EFAULT;
 
-	log->w_off = logger_offset(log, log->w_off + count);
-
 	return count;
 }
 
+/*
+ * do_clear_log - zero 'count' bytes of 'log' at 'off'.
+ */
+static void do_clear_log(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len;
+
+	len = min(count, log->size - off);
+	memset(log->buffer + off, 0, len);
+
+	if (count != len)
+		memset(log->buffer, 0, count - len);
+}
+
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
- * them above all else.
+ * them above all else: concurrent writers only serialize on reserving
+ * room, never on copying their payload.
  */
 static ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	struct logger_reservation res;
 	struct logger_entry header;
 	struct timespec now;
+	size_t off;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -488,17 +677,10 @@ static ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+	res.len = sizeof(struct logger_entry) + header.len;
+	logger_reserve(log, &res);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	off = do_write_log(log, res.off, &header, sizeof(struct logger_entry));
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -508,21 +690,25 @@ static ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log, off, iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			/*
+			 * Later writers may already have reserved room past
+			 * ours, so the entry cannot be taken back. Blank the
+			 * payload rather than let a partial message through.
+			 */
+			do_clear_log(log, logger_offset(log, res.off +
+				sizeof(struct logger_entry)), header.len);
+			logger_commit(log, &res);
 			return nr;
 		}
 
 		iov++;
 		ret += nr;
+		off = logger_offset(log, off + nr);
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, &res);
 
 	return ret;
 }
@@ -564,14 +750,17 @@ static int logger_open(struct inode *inode, struct file *file)
 
 		reader->log = log;
 		reader->r_ver = 1;
+		reader->r_seq = 0;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 
 		file->private_data = reader;
@@ -593,7 +782,9 @@ static int logger_release(struct inode *ignored, struct file *file)
 		struct logger_log *log = reader->log;
 
 		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
 		mutex_unlock(&log->mutex);
 
 		kfree(reader);
@@ -609,7 +800,8 @@ static int logger_release(struct inode *ignored, struct file *file)
  * Note also that, strictly speaking, a return value of POLLIN does not
  * guarantee that the log is readable without blocking, as there is a small
  * chance that the writer can lap the reader in the interim between poll()
- * returning and the read() request.
+ * returning and the read() request. Wakeups are batched, see
+ * logger_wake_readers(), but an entry is reported as soon as it is complete.
  */
 static unsigned int logger_poll(struct file *file, poll_table *wait)
 {
@@ -626,17 +818,116 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
 
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
+	spin_unlock(&log->lock);
 	mutex_unlock(&log->mutex);
 
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the whole ring read-only, for readers that see all entries anyway.
+ * See struct logger_position for how to consume it.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+
+	/* a mapping cannot filter out other users' entries */
+	if (!reader->r_all)
+		return -EPERM;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != log->size)
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, log->buffer, 0);
+}
+
+/*
+ * is_entry_boundary - is 'to' the start of an entry, or w_off, when
+ * walking complete entries from 'from'?
+ *
+ * Caller needs to hold log->lock.
+ */
+static bool is_entry_boundary(struct logger_log *log, size_t from, size_t to)
+{
+	size_t left = logger_offset(log, to - from);
+
+	if (left > logger_offset(log, log->w_off - from))
+		return false;
+
+	while (left) {
+		size_t nr = sizeof(struct logger_entry) +
+			get_entry_msg_len(log, from);
+
+		if (nr > left)
+			return false;
+		from = logger_offset(log, from + nr);
+		left -= nr;
+	}
+
+	return true;
+}
+
+static long logger_get_position(struct logger_log *log,
+				struct logger_reader *reader, void __user *arg)
+{
+	struct logger_position pos;
+
+	spin_lock(&log->lock);
+	pos.r_off = reader->r_off;
+	pos.w_off = log->w_off;
+	pos.seq = reader->r_seq;
+	spin_unlock(&log->lock);
+
+	if (copy_to_user(arg, &pos, sizeof(pos)))
+		return -EFAULT;
+	return 0;
+}
+
+static long logger_set_position(struct logger_log *log,
+				struct logger_reader *reader, void __user *arg)
+{
+	struct logger_position pos;
+	long ret = 0;
+
+	if (copy_from_user(&pos, arg, sizeof(pos)))
+		return -EFAULT;
+
+	if (pos.r_off >= log->size)
+		return -EINVAL;
+
+	spin_lock(&log->lock);
+	if (pos.seq != reader->r_seq)
+		ret = -EAGAIN;
+	else if (!is_entry_boundary(log, reader->r_off, pos.r_off))
+		ret = -EINVAL;
+	else
+		reader->r_off = pos.r_off;
+	spin_unlock(&log->lock);
+
+	return ret;
+}
+
 static long logger_set_version(struct logger_reader *reader, void __user *arg)
 {
 	int version;
@@ -669,10 +960,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
+		spin_lock(&log->lock);
 		if (log->w_off >= reader->r_off)
 			ret = log->w_off - reader->r_off;
 		else
 			ret = (log->size - reader->r_off) + log->w_off;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -681,6 +974,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		reader = file->private_data;
 
+		spin_lock(&log->lock);
 		if (!reader->r_all)
 			reader->r_off = get_next_entry_by_uid(log,
 				reader->r_off, current_euid());
@@ -690,6 +984,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				get_entry_msg_len(log, reader->r_off);
 		else
 			ret = 0;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
@@ -701,9 +996,13 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			ret = -EPERM;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
+		spin_lock(&log->lock);
+		list_for_each_entry(reader, &log->readers, list) {
 			reader->r_off = log->w_off;
+			reader->r_seq++;
+		}
 		log->head = log->w_off;
+		spin_unlock(&log->lock);
 		ret = 0;
 		break;
 	case LOGGER_GET_VERSION:
@@ -722,6 +1021,22 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_GET_POSITION:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		ret = logger_get_position(log, reader, argp);
+		break;
+	case LOGGER_SET_POSITION:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		ret = logger_set_position(log, reader, argp);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -734,6 +1049,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -742,7 +1058,8 @@ static const struct file_operations logger_fops = {
 
 /*
  * Log size must must be a power of two, and greater than
- * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)).
+ * (LOGGER_ENTRY_MAX_PAYLOAD + sizeof(struct logger_entry)). It must also be
+ * a multiple of PAGE_SIZE for the log to be mmap()ed.
  */
 static int __init create_log(char *log_name, int size)
 {
@@ -750,7 +1067,8 @@ static int __init create_log(char *log_name, int size)
 	struct logger_log *log;
 	unsigned char *buffer;
 
-	buffer = vmalloc(size);
+	/* zeroed and mappable, see logger_mmap() */
+	buffer = vmalloc_user(size);
 	if (buffer == NULL)
 		return -ENOMEM;
 
@@ -774,7 +1092,13 @@ static int __init create_log(char *log_name, int size)
 	init_waitqueue_head(&log->wq);
 	INIT_LIST_HEAD(&log->readers);
 	mutex_init(&log->mutex);
+	spin_lock_init(&log->lock);
 	log->w_off = 0;
+	log->w_head = 0;
+	INIT_LIST_HEAD(&log->pending);
+	init_waitqueue_head(&log->room_wq);
+	atomic_set(&log->wake_bytes, 0);
+	setup_timer(&log->wake_timer, logger_wake_timer, (unsigned long) log);
 	log->head = 0;
 	log->size = size;
 
@@ -833,6 +1157,7 @@ static void __exit logger_exit(void)
 	list_for_each_entry_safe(current_log, next_log, &log_list, logs) {
 		/* we have to delete all the entry inside log_list */
 		misc_deregister(&current_log->misc);
+		del_timer_sync(&current_log->wake_timer);
 		vfree(current_log->buffer);
 		kfree(current_log->misc.name);
 		list_del(&current_log->logs);
@@ -70,6 +70,26 @@ struct logger_entry {
 	char		msg[0];
 };
 
+/**
+ * struct logger_position - where a reader stands in a memory mapped log
+ * @r_off:	Offset of the reader's next entry in the mapping
+ * @w_off:	Offset just past the last complete entry
+ * @seq:	Number of times the reader was pulled forward by writers
+ *
+ * A reader with the log mmap()ed can use LOGGER_GET_POSITION to find the
+ * entries between @r_off and @w_off, laid out as struct logger_entry
+ * headers each followed by its payload, wrapping at the end of the
+ * mapping. Once done with them, it passes the offset it got to, with
+ * the @seq it was given, to LOGGER_SET_POSITION. That fails with EAGAIN
+ * if writers overwrote part of those entries meanwhile, in which case
+ * what was read must be discarded.
+ */
+struct logger_position {
+	__u32		r_off;
+	__u32		w_off;
+	__u32		seq;
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -85,5 +105,7 @@ struct logger_entry {
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
 #define LOGGER_GET_VERSION		_IO(__LOGGERIO, 5) /* abi version */
 #define LOGGER_SET_VERSION		_IO(__LOGGERIO, 6) /* abi version */
+#define LOGGER_GET_POSITION		_IOR(__LOGGERIO, 7, struct logger_position)
+#define LOGGER_SET_POSITION		_IOW(__LOGGERIO, 8, struct logger_position)
 
 #endif /* _LINUX_LOGGER_H */
@@ -41,6 +41,18 @@
 #include <linux/rcupdate.h>
 #include <linux/profile.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/err.h>
+#include <linux/spinlock.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmpressure.h>
+
+#define CREATE_TRACE_POINTS
+#include "lowmemorykiller_trace.h"
 
 static uint32_t lowmem_debug_level = 1;
 static short lowmem_adj[6] = {
@@ -70,16 +82,235 @@ static unsigned long lowmem_deathpending_timeout;
 			pr_info(x);			\
 	} while (0)
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+/*
+ * Look at one thread group for lowmem_shrink(). Returns 1 and fills in
+ * *victim, *tasksize and *oom_score_adj if it can be killed, 0 if it
+ * cannot and -EBUSY if it is still dying from an earlier kill.
+ */
+static int lowmem_check_task(struct task_struct *tsk, short min_score_adj,
+			     int white_size, struct task_struct **victim,
+			     int *tasksize, short *oom_score_adj)
+{
+	struct task_struct *p;
+	int i;
+
+	if (tsk->flags & PF_KTHREAD)
+		return 0;
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return 0;
+
+	if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		task_unlock(p);
+		return -EBUSY;
+	}
+
+	for (i = 0; i < white_size; i++) {
+		if (p->pid == white_list[i]) {
+			lowmem_print(2, "pid %d to white list", p->pid);
+			task_unlock(p);
+			return 0;
+		}
+	}
+
+	*oom_score_adj = p->signal->oom_score_adj;
+	if (*oom_score_adj < min_score_adj) {
+		task_unlock(p);
+		return 0;
+	}
+	*tasksize = get_mm_rss(p->mm);
+	task_unlock(p);
+	*victim = p;
+	return *tasksize > 0;
+}
+
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+/*
+ * Thread group leaders, hashed by oom_score_adj. Writers hold
+ * lmk_adj_lock with interrupts off, since fork and exit take it inside
+ * write_lock_irq(&tasklist_lock) while oom_score_adj writers take it
+ * with nothing held. lowmem_shrink() only walks the buckets under RCU: a
+ * task moved to another bucket while we look at it may be missed or
+ * seen twice, which is fine as the next scan will catch it. The task
+ * structs themselves are RCU freed.
+ */
+#define LMK_ADJ_BUCKETS		(OOM_SCORE_ADJ_MAX - OOM_SCORE_ADJ_MIN + 1)
+#define lmk_adj_bucket(adj)	((adj) - OOM_SCORE_ADJ_MIN)
+
+static struct hlist_head lmk_adj_buckets[LMK_ADJ_BUCKETS];
+static DECLARE_BITMAP(lmk_adj_nonempty, LMK_ADJ_BUCKETS);
+static DEFINE_SPINLOCK(lmk_adj_lock);
+
+static void __lmk_adj_add(struct task_struct *p, int adj)
+{
+	int b = lmk_adj_bucket(adj);
+
+	p->lmk_adj = adj;
+	hlist_add_head_rcu(&p->lmk_adj_node, &lmk_adj_buckets[b]);
+	__set_bit(b, lmk_adj_nonempty);
+}
+
+static void __lmk_adj_del(struct task_struct *p)
+{
+	int b = lmk_adj_bucket(p->lmk_adj);
+
+	hlist_del_init_rcu(&p->lmk_adj_node);
+	if (hlist_empty(&lmk_adj_buckets[b]))
+		__clear_bit(b, lmk_adj_nonempty);
+}
+
+/* fork of a new thread group, with tasklist_lock held */
+void lmk_adj_add(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_lock, flags);
+	__lmk_adj_add(p, p->signal->oom_score_adj);
+	spin_unlock_irqrestore(&lmk_adj_lock, flags);
+}
+
+/* the thread group is gone, with tasklist_lock held */
+void lmk_adj_remove(struct task_struct *p)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_lock, flags);
+	if (!hlist_unhashed(&p->lmk_adj_node))
+		__lmk_adj_del(p);
+	spin_unlock_irqrestore(&lmk_adj_lock, flags);
+}
+
+/* exec from a non-leader thread made @new the group leader */
+void lmk_adj_replace(struct task_struct *old, struct task_struct *new)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lmk_adj_lock, flags);
+	if (!hlist_unhashed(&old->lmk_adj_node)) {
+		__lmk_adj_del(old);
+		__lmk_adj_add(new, new->signal->oom_score_adj);
+	}
+	spin_unlock_irqrestore(&lmk_adj_lock, flags);
+}
+
+/* oom_score_adj of the thread group of @p may have changed */
+void lmk_adj_update(struct task_struct *p)
 {
-	struct task_struct *tsk;
+	struct task_struct *leader;
+	unsigned long flags;
+	int adj;
+
+	rcu_read_lock();
+	spin_lock_irqsave(&lmk_adj_lock, flags);
+	leader = p->group_leader;
+	adj = leader->signal->oom_score_adj;
+	if (!hlist_unhashed(&leader->lmk_adj_node) && leader->lmk_adj != adj) {
+		__lmk_adj_del(leader);
+		__lmk_adj_add(leader, adj);
+	}
+	spin_unlock_irqrestore(&lmk_adj_lock, flags);
+	rcu_read_unlock();
+}
+
+/*
+ * Only the highest populated buckets are looked at: the first one
+ * holding a candidate gives the victim, its largest task.
+ */
+static struct task_struct *lowmem_select(short min_score_adj, int white_size,
+					 int *selected_tasksize,
+					 short *selected_oom_score_adj,
+					 int *scanned)
+{
+	struct task_struct *tsk, *p;
+	struct task_struct *selected = NULL;
+	struct hlist_node *node;
+	unsigned long b = LMK_ADJ_BUCKETS;
+	unsigned long next;
+	int tasksize;
+	short oom_score_adj;
+	int ret;
+
+	while (!selected && b) {
+		/* find_last_bit() returns its size argument if none is set */
+		next = find_last_bit(lmk_adj_nonempty, b);
+		if (next == b || next < lmk_adj_bucket(min_score_adj))
+			break;
+		b = next;
+		hlist_for_each_entry_rcu(tsk, node, &lmk_adj_buckets[b],
+					 lmk_adj_node) {
+			(*scanned)++;
+			ret = lowmem_check_task(tsk, min_score_adj, white_size,
+						&p, &tasksize, &oom_score_adj);
+			if (ret < 0)
+				return ERR_PTR(ret);
+			if (!ret)
+				continue;
+			if (selected) {
+				if (oom_score_adj < *selected_oom_score_adj)
+					continue;
+				if (oom_score_adj == *selected_oom_score_adj &&
+				    tasksize <= *selected_tasksize)
+					continue;
+			}
+			selected = p;
+			*selected_tasksize = tasksize;
+			*selected_oom_score_adj = oom_score_adj;
+			lowmem_print(2, "select %d (%s), adj %hd, size %d, to kill\n",
+				     p->pid, p->comm, oom_score_adj,
+				     tasksize);
+		}
+	}
+	return selected;
+}
+#else
+static struct task_struct *lowmem_select(short min_score_adj, int white_size,
+					 int *selected_tasksize,
+					 short *selected_oom_score_adj,
+					 int *scanned)
+{
+	struct task_struct *tsk, *p;
 	struct task_struct *selected = NULL;
-	int rem = 0;
 	int tasksize;
+	short oom_score_adj;
+	int ret;
+
+	for_each_process(tsk) {
+		(*scanned)++;
+		ret = lowmem_check_task(tsk, min_score_adj, white_size,
+					&p, &tasksize, &oom_score_adj);
+		if (ret < 0)
+			return ERR_PTR(ret);
+		if (!ret)
+			continue;
+		if (selected) {
+			if (oom_score_adj < *selected_oom_score_adj)
+				continue;
+			if (oom_score_adj == *selected_oom_score_adj &&
+			    tasksize <= *selected_tasksize)
+				continue;
+		}
+		selected = p;
+		*selected_tasksize = tasksize;
+		*selected_oom_score_adj = oom_score_adj;
+		lowmem_print(2, "select %d (%s), adj %hd, size %d, to kill\n",
+			     p->pid, p->comm, oom_score_adj, tasksize);
+	}
+	return selected;
+}
+#endif
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
+	int rem = 0;
 	int i;
 	short min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
 	short selected_oom_score_adj;
+	int scanned = 0;
+	ktime_t start;
 	int white_size = ARRAY_SIZE(white_list);
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES) - totalreserve_pages;
@@ -114,60 +345,18 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
+	start = ktime_get();
 	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		short oom_score_adj;
-		int white = 0;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-		
-		if (test_tsk_thread_flag(p, TIF_MEMDIE) &&
-		    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			task_unlock(p);
-			rcu_read_unlock();
-			return 0;
-		}
-
-		for (i = 0; i < white_size; i++) {
-			if (p->pid == white_list[i]) {
-				white = 1;
-				lowmem_print(2, "pid %d to white list", p->pid);
-				break;
-			}
-		}
-		if (white) {
-			task_unlock(p);
-			continue;
-		}
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		lowmem_print(2, "select %d (%s), adj %hd, size %d, to kill\n",
-			     p->pid, p->comm, oom_score_adj, tasksize);
+	selected = lowmem_select(min_score_adj, white_size, &selected_tasksize,
+				 &selected_oom_score_adj, &scanned);
+	if (IS_ERR(selected)) {
+		rcu_read_unlock();
+		return 0;
 	}
+	trace_lowmemorykiller_select(selected ? selected->pid : -1,
+				     selected_oom_score_adj, selected_tasksize,
+				     scanned,
+				     ktime_to_ns(ktime_sub(ktime_get(), start)));
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %hd, size %d\n",
 			     selected->pid, selected->comm,
@@ -183,6 +372,200 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	return rem;
 }
 
+#ifdef CONFIG_ANDROID_LMK_PRESSURE
+/*
+ * /dev/mem_pressure lets userspace act on reclaim pressure before the
+ * minfree thresholds above are reached. Each open file has a minimum
+ * level, "low" by default, changed by writing "low", "medium" or
+ * "critical". poll() reports POLLIN once an event at or above that
+ * level has happened since the last read, and read() returns the name
+ * of the latest such level followed by a newline.
+ */
+struct lowmem_pressure_reader {
+	enum vmpressure_level min_level;
+	unsigned int seen;
+};
+
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+/* sequence number and level of the last event at or above each level */
+static unsigned int lowmem_pressure_seq[VMPRESSURE_NUM_LEVELS];
+static enum vmpressure_level lowmem_pressure_level[VMPRESSURE_NUM_LEVELS];
+static unsigned int lowmem_pressure_events;
+
+static int lowmem_pressure_notify(struct notifier_block *nb,
+				  unsigned long level, void *unused)
+{
+	int i;
+
+	spin_lock(&lowmem_pressure_lock);
+	lowmem_pressure_events++;
+	for (i = 0; i <= level; i++) {
+		lowmem_pressure_seq[i] = lowmem_pressure_events;
+		lowmem_pressure_level[i] = level;
+	}
+	spin_unlock(&lowmem_pressure_lock);
+
+	lowmem_print(3, "pressure %s\n", vmpressure_level_name(level));
+	wake_up_interruptible(&lowmem_pressure_wait);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_pressure_nb = {
+	.notifier_call = lowmem_pressure_notify,
+};
+
+static bool lowmem_pressure_pending(struct lowmem_pressure_reader *reader)
+{
+	bool ret;
+
+	spin_lock(&lowmem_pressure_lock);
+	ret = lowmem_pressure_seq[reader->min_level] != reader->seen;
+	spin_unlock(&lowmem_pressure_lock);
+	return ret;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	spin_lock(&lowmem_pressure_lock);
+	reader->min_level = VMPRESSURE_LOW;
+	reader->seen = lowmem_pressure_seq[VMPRESSURE_LOW];
+	spin_unlock(&lowmem_pressure_lock);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	struct lowmem_pressure_reader *reader = file->private_data;
+	enum vmpressure_level level;
+	unsigned int seq;
+	char kbuf[16];
+	size_t len;
+	int ret;
+
+	while (1) {
+		spin_lock(&lowmem_pressure_lock);
+		if (lowmem_pressure_seq[reader->min_level] != reader->seen)
+			break;
+		spin_unlock(&lowmem_pressure_lock);
+
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+					       lowmem_pressure_pending(reader));
+		if (ret)
+			return ret;
+	}
+	seq = lowmem_pressure_seq[reader->min_level];
+	level = lowmem_pressure_level[reader->min_level];
+	spin_unlock(&lowmem_pressure_lock);
+
+	/* the event is only consumed once it has reached the reader */
+	len = scnprintf(kbuf, sizeof(kbuf), "%s\n",
+			vmpressure_level_name(level));
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, kbuf, len))
+		return -EFAULT;
+	reader->seen = seq;
+	return len;
+}
+
+static ssize_t lowmem_pressure_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *pos)
+{
+	struct lowmem_pressure_reader *reader = file->private_data;
+	char kbuf[16];
+	int level;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	for (level = 0; level < VMPRESSURE_NUM_LEVELS; level++)
+		if (sysfs_streq(kbuf, vmpressure_level_name(level)))
+			break;
+	if (level == VMPRESSURE_NUM_LEVELS)
+		return -EINVAL;
+
+	/* only events from now on count against the new level */
+	spin_lock(&lowmem_pressure_lock);
+	reader->min_level = level;
+	reader->seen = lowmem_pressure_seq[level];
+	spin_unlock(&lowmem_pressure_lock);
+	return count;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_pressure_reader *reader = file->private_data;
+
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (lowmem_pressure_pending(reader))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.release = lowmem_pressure_release,
+	.read = lowmem_pressure_read,
+	.write = lowmem_pressure_write,
+	.poll = lowmem_pressure_poll,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
+static int __init lowmem_pressure_init(void)
+{
+	int ret;
+
+	ret = misc_register(&lowmem_pressure_misc);
+	if (ret)
+		return ret;
+	vmpressure_register_notifier(&lowmem_pressure_nb);
+	return 0;
+}
+
+static void __exit lowmem_pressure_exit(void)
+{
+	vmpressure_unregister_notifier(&lowmem_pressure_nb);
+	misc_deregister(&lowmem_pressure_misc);
+}
+#else
+static inline int lowmem_pressure_init(void)
+{
+	return 0;
+}
+
+static inline void lowmem_pressure_exit(void)
+{
+}
+#endif
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -191,11 +574,14 @@ static struct shrinker lowmem_shrinker = {
 static int __init lowmem_init(void)
 {
 	register_shrinker(&lowmem_shrinker);
+	if (lowmem_pressure_init())
+		pr_err("failed to register the memory pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	lowmem_pressure_exit();
 	unregister_shrinker(&lowmem_shrinker);
 }
 
@@ -0,0 +1,56 @@
+/*
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lowmemorykiller
+
+#if !defined(_LOWMEMORYKILLER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOWMEMORYKILLER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Emitted each time lowmem_shrink() looks for a victim: pid is -1 if
+ * none was found. scanned is the number of tasks looked at and
+ * latency_ns the time the search took.
+ */
+TRACE_EVENT(lowmemorykiller_select,
+	TP_PROTO(pid_t pid, short oom_score_adj, int tasksize,
+		 int scanned, s64 latency_ns),
+	TP_ARGS(pid, oom_score_adj, tasksize, scanned, latency_ns),
+
+	TP_STRUCT__entry(
+		__field(pid_t, pid)
+		__field(short, oom_score_adj)
+		__field(int, tasksize)
+		__field(int, scanned)
+		__field(s64, latency_ns)
+	),
+	TP_fast_assign(
+		__entry->pid = pid;
+		__entry->oom_score_adj = oom_score_adj;
+		__entry->tasksize = tasksize;
+		__entry->scanned = scanned;
+		__entry->latency_ns = latency_ns;
+	),
+	TP_printk("pid=%d adj=%hd size=%d scanned=%d latency=%lldns",
+		  __entry->pid, __entry->oom_score_adj, __entry->tasksize,
+		  __entry->scanned, __entry->latency_ns)
+);
+
+#endif /* _LOWMEMORYKILLER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE lowmemorykiller_trace
+#include <trace/define_trace.h>
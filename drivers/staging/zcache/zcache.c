@@ -64,6 +64,10 @@
  * (3) one of PAGE_SIZE/64 "unbuddied" lists indexed by how many chunks
  * the one unbuddied zbud uses.  The data inside a zbpg cannot be
  * read or written unless the zbpg's lock is held.
+ *
+ * Every zbpg holding at least one zbud is also on the zbud LRU list,
+ * ordered by the time of the most recent put to it.  Eviction starts
+ * from the oldest end.
  */
 
 #define ZBH_SENTINEL  0x43214321
@@ -81,6 +85,7 @@ struct zbud_hdr {
 
 struct zbud_page {
 	struct list_head bud_list;
+	struct list_head lru;
 	spinlock_t lock;
 	struct zbud_hdr buddy[ZBUD_MAX_BUDS];
 	DECL_SENTINEL
@@ -105,7 +110,10 @@ static unsigned long zbud_cumul_chunk_counts[NCHUNKS];
 struct list_head zbud_buddied_list;
 static unsigned long zcache_zbud_buddied_count;
 
-/* protects the buddied list and all unbuddied lists */
+static LIST_HEAD(zbud_lru_list);
+static unsigned long zcache_zbud_lru_count;
+
+/* protects the buddied list, all unbuddied lists and the LRU list */
 static DEFINE_SPINLOCK(zbud_budlists_spinlock);
 
 static LIST_HEAD(zbpg_unused_list);
@@ -201,6 +209,7 @@ static struct zbud_page *zbud_alloc_raw_page(void)
 		zbpg = zcache_get_free_page();
 	if (likely(zbpg != NULL)) {
 		INIT_LIST_HEAD(&zbpg->bud_list);
+		INIT_LIST_HEAD(&zbpg->lru);
 		zh0 = &zbpg->buddy[0]; zh1 = &zbpg->buddy[1];
 		spin_lock_init(&zbpg->lock);
 		if (recycled) {
@@ -226,6 +235,7 @@ static void zbud_free_raw_page(struct zbud_page *zbpg)
 
 	ASSERT_SENTINEL(zbpg, ZBPG);
 	BUG_ON(!list_empty(&zbpg->bud_list));
+	BUG_ON(!list_empty(&zbpg->lru));
 	ASSERT_SPINLOCK(&zbpg->lock);
 	BUG_ON(zh0->size != 0 || tmem_oid_valid(&zh0->oid));
 	BUG_ON(zh1->size != 0 || tmem_oid_valid(&zh1->oid));
@@ -279,6 +289,8 @@ static void zbud_free_and_delist(struct zbud_hdr *zh)
 		spin_lock(&zbud_budlists_spinlock);
 		BUG_ON(list_empty(&zbud_unbuddied[chunks].list));
 		list_del_init(&zbpg->bud_list);
+		list_del_init(&zbpg->lru);
+		zcache_zbud_lru_count--;
 		zbud_unbuddied[chunks].count--;
 		spin_unlock(&zbud_budlists_spinlock);
 		zbud_free_raw_page(zbpg);
@@ -327,6 +339,8 @@ static struct zbud_hdr *zbud_create(uint32_t pool_id, struct tmem_oid *oid,
 	spin_lock(&zbud_budlists_spinlock);
 	list_add_tail(&zbpg->bud_list, &zbud_unbuddied[nchunks].list);
 	zbud_unbuddied[nchunks].count++;
+	list_add_tail(&zbpg->lru, &zbud_lru_list);
+	zcache_zbud_lru_count++;
 	zh = &zbpg->buddy[0];
 	goto init_zh;
 
@@ -346,6 +360,7 @@ found_unbuddied:
 	zbud_unbuddied[found_good_buddy].count--;
 	list_add_tail(&zbpg->bud_list, &zbud_buddied_list);
 	zcache_zbud_buddied_count++;
+	list_move_tail(&zbpg->lru, &zbud_lru_list);
 
 init_zh:
 	SET_SENTINEL(zh, ZBH);
@@ -400,7 +415,7 @@ out:
 
 /*
  * The following routines handle shrinking of ephemeral pages by evicting
- * pages "least valuable" first.
+ * pages least recently put first.
  */
 
 static unsigned long zcache_evicted_raw_pages;
@@ -409,6 +424,31 @@ static unsigned long zcache_evicted_unbuddied_pages;
 
 static struct tmem_pool *zcache_get_pool_by_id(uint32_t poolid);
 static void zcache_put_pool(struct tmem_pool *pool);
+static void zcache_pool_count_evict(uint32_t poolid);
+
+/*
+ * Take a zbpg off the buddied/unbuddied and LRU lists before eviction.
+ * Both the budlists lock and the zbpg lock must be held.
+ */
+static void zbud_unlist(struct zbud_page *zbpg)
+{
+	struct zbud_hdr *zh0 = &zbpg->buddy[0], *zh1 = &zbpg->buddy[1];
+	unsigned chunks;
+
+	ASSERT_SPINLOCK(&zbud_budlists_spinlock);
+	ASSERT_SPINLOCK(&zbpg->lock);
+	if (zh0->size != 0 && zh1->size != 0) {
+		zcache_zbud_buddied_count--;
+		zcache_evicted_buddied_pages++;
+	} else {
+		chunks = zbud_size_to_chunks(zh0->size ? zh0->size : zh1->size);
+		zbud_unbuddied[chunks].count--;
+		zcache_evicted_unbuddied_pages++;
+	}
+	list_del_init(&zbpg->bud_list);
+	list_del_init(&zbpg->lru);
+	zcache_zbud_lru_count--;
+}
 
 /*
  * Flush and free all zbuds in a zbpg, then free the pageframe
@@ -438,6 +478,7 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 		pool = zcache_get_pool_by_id(pool_id[i]);
 		if (pool != NULL) {
 			tmem_flush_page(pool, &oid[i], index[i]);
+			zcache_pool_count_evict(pool_id[i]);
 			zcache_put_pool(pool);
 		}
 	}
@@ -447,19 +488,25 @@ static void zbud_evict_zbpg(struct zbud_page *zbpg)
 }
 
 /*
- * Free nr pages.  This code is funky because we want to hold the locks
- * protecting various lists for as short a time as possible, and in some
- * circumstances the list may change asynchronously when the list lock is
- * not held.  In some cases we also trylock not only to avoid waiting on a
- * page in use by another cpu, but also to avoid potential deadlock due to
- * lock inversion.
+ * Free up to nr pages, returning the number actually freed.  This code
+ * is funky because we want to hold the locks protecting various lists
+ * for as short a time as possible, and in some circumstances the list
+ * may change asynchronously when the list lock is not held.  In some
+ * cases we also trylock not only to avoid waiting on a page in use by
+ * another cpu, but also to avoid potential deadlock due to lock
+ * inversion.
+ *
+ * Pages on the unused list cost nothing to free, so they go first.
+ * After that the oldest zbpg on the LRU list is evicted, which parks
+ * it on the unused list, and the loop frees it from there.
  */
-static void zbud_evict_pages(int nr)
+static int zbud_evict_pages(int nr)
 {
 	struct zbud_page *zbpg;
-	int i;
+	int freed = 0;
 
-	/* first try freeing any pages on unused list */
+	if (nr <= 0)
+		goto out;
 retry_unused_list:
 	spin_lock_bh(&zbpg_unused_list_spinlock);
 	if (!list_empty(&zbpg_unused_list)) {
@@ -472,61 +519,26 @@ retry_unused_list:
 		spin_unlock_bh(&zbpg_unused_list_spinlock);
 		zcache_free_page(zbpg);
 		zcache_evicted_raw_pages++;
-		if (--nr <= 0)
+		if (++freed >= nr)
 			goto out;
 		goto retry_unused_list;
 	}
 	spin_unlock_bh(&zbpg_unused_list_spinlock);
 
-	/* now try freeing unbuddied pages, starting with least space avail */
-	for (i = 0; i < MAX_CHUNK; i++) {
-retry_unbud_list_i:
-		spin_lock_bh(&zbud_budlists_spinlock);
-		if (list_empty(&zbud_unbuddied[i].list)) {
-			spin_unlock_bh(&zbud_budlists_spinlock);
-			continue;
-		}
-		list_for_each_entry(zbpg, &zbud_unbuddied[i].list, bud_list) {
-			if (unlikely(!spin_trylock(&zbpg->lock)))
-				continue;
-			list_del_init(&zbpg->bud_list);
-			zbud_unbuddied[i].count--;
-			spin_unlock(&zbud_budlists_spinlock);
-			zcache_evicted_unbuddied_pages++;
-			/* want budlists unlocked when doing zbpg eviction */
-			zbud_evict_zbpg(zbpg);
-			local_bh_enable();
-			if (--nr <= 0)
-				goto out;
-			goto retry_unbud_list_i;
-		}
-		spin_unlock_bh(&zbud_budlists_spinlock);
-	}
-
-	/* as a last resort, free buddied pages */
-retry_bud_list:
 	spin_lock_bh(&zbud_budlists_spinlock);
-	if (list_empty(&zbud_buddied_list)) {
-		spin_unlock_bh(&zbud_budlists_spinlock);
-		goto out;
-	}
-	list_for_each_entry(zbpg, &zbud_buddied_list, bud_list) {
+	list_for_each_entry(zbpg, &zbud_lru_list, lru) {
 		if (unlikely(!spin_trylock(&zbpg->lock)))
 			continue;
-		list_del_init(&zbpg->bud_list);
-		zcache_zbud_buddied_count--;
+		zbud_unlist(zbpg);
 		spin_unlock(&zbud_budlists_spinlock);
-		zcache_evicted_buddied_pages++;
 		/* want budlists unlocked when doing zbpg eviction */
 		zbud_evict_zbpg(zbpg);
 		local_bh_enable();
-		if (--nr <= 0)
-			goto out;
-		goto retry_bud_list;
+		goto retry_unused_list;
 	}
 	spin_unlock_bh(&zbud_budlists_spinlock);
 out:
-	return;
+	return freed;
 }
 
 static void zbud_init(void)
@@ -684,6 +696,25 @@ static struct {
 	struct xv_pool *xvpool;
 } zcache_client;
 
+/*
+ * Per-pool counters, indexed by pool id and cleared when the id is
+ * handed out again.  Like the global counters they are not atomic:
+ * they are for tuning, not accounting.
+ */
+static struct {
+	unsigned long puts;
+	unsigned long failed_puts;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evicts;
+	unsigned long flushes;
+} zcache_pool_stats[MAX_POOLS_PER_CLIENT];
+
+static void zcache_pool_count_evict(uint32_t poolid)
+{
+	zcache_pool_stats[poolid].evicts++;
+}
+
 /*
  * Tmem operations assume the poolid implies the invoking client.
  * Zcache only has one client (the kernel itself), so translate
@@ -1067,6 +1098,31 @@ static struct notifier_block zcache_cpu_notifier_block = {
 };
 
 #ifdef CONFIG_SYSFS
+/* one line per live pool: hit rate, churn and evictions */
+static int zcache_show_pool_stats(char *buf)
+{
+	struct tmem_pool *pool;
+	char *p = buf;
+	int i;
+
+	p += sprintf(p, "id type puts failed_puts hits misses evicts flushes\n");
+	for (i = 0; i < MAX_POOLS_PER_CLIENT; i++) {
+		pool = zcache_get_pool_by_id(i);
+		if (pool == NULL)
+			continue;
+		p += sprintf(p, "%d %s %lu %lu %lu %lu %lu %lu\n", i,
+			is_ephemeral(pool) ? "eph" : "pers",
+			zcache_pool_stats[i].puts,
+			zcache_pool_stats[i].failed_puts,
+			zcache_pool_stats[i].hits,
+			zcache_pool_stats[i].misses,
+			zcache_pool_stats[i].evicts,
+			zcache_pool_stats[i].flushes);
+		zcache_put_pool(pool);
+	}
+	return p - buf;
+}
+
 #define ZCACHE_SYSFS_RO(_name) \
 	static ssize_t zcache_##_name##_show(struct kobject *kobj, \
 				struct kobj_attribute *attr, char *buf) \
@@ -1130,6 +1186,7 @@ ZCACHE_SYSFS_RO_CUSTOM(zbud_unbuddied_list_counts,
 			zbud_show_unbuddied_list_counts);
 ZCACHE_SYSFS_RO_CUSTOM(zbud_cumul_chunk_counts,
 			zbud_show_cumul_chunk_counts);
+ZCACHE_SYSFS_RO_CUSTOM(pool_stats, zcache_show_pool_stats);
 
 static struct attribute *zcache_attrs[] = {
 	&zcache_curr_obj_count_attr.attr,
@@ -1160,6 +1217,7 @@ static struct attribute *zcache_attrs[] = {
 	&zcache_aborted_shrink_attr.attr,
 	&zcache_zbud_unbuddied_list_counts_attr.attr,
 	&zcache_zbud_cumul_chunk_counts_attr.attr,
+	&zcache_pool_stats_attr.attr,
 	NULL,
 };
 
@@ -1180,27 +1238,48 @@ static bool zcache_freeze;
 
 /*
  * zcache shrinker interface (only useful for ephemeral pages, so zbud only)
+ *
+ * The count reported is the number of zbpgs the shrinker can actually
+ * free: those on the LRU list plus those parked on the unused list.
+ * zbpgs in the middle of a put are not counted.  vmscan takes the drop
+ * in that count across a scan as the number of objects reclaimed, so
+ * the count returned after a scan is the one taken before it less what
+ * zbud_evict_pages() really freed, not a fresh read that concurrent
+ * puts may have inflated.  Dropping a cleancache page costs a disk read
+ * on the next access, just like dropping a page cache page, hence
+ * DEFAULT_SEEKS.
  */
+static int zcache_evictable_pages(void)
+{
+	return (int)(zcache_zbud_lru_count + zcache_zbpg_unused_list_count);
+}
+
 static int shrink_zcache_memory(struct shrinker *shrink,
 				struct shrink_control *sc)
 {
-	int ret = -1;
 	int nr = sc->nr_to_scan;
-	gfp_t gfp_mask = sc->gfp_mask;
+	int count, freed;
 
-	if (nr >= 0) {
-		if (!(gfp_mask & __GFP_FS))
-			/* does this case really need to be skipped? */
-			goto out;
-		if (spin_trylock(&zcache_direct_reclaim_lock)) {
-			zbud_evict_pages(nr);
-			spin_unlock(&zcache_direct_reclaim_lock);
-		} else
-			zcache_aborted_shrink++;
+	count = zcache_evictable_pages();
+	if (nr <= 0)
+		return count;
+
+	/*
+	 * Leave the work to a __GFP_FS reclaimer, as the filesystem
+	 * shrinkers do: -1 makes vmscan defer this scan rather than
+	 * believe that it freed nothing from a full cache.
+	 */
+	if (!(sc->gfp_mask & __GFP_FS))
+		return -1;
+
+	if (!spin_trylock(&zcache_direct_reclaim_lock)) {
+		zcache_aborted_shrink++;
+		return -1;
 	}
-	ret = (int)atomic_read(&zcache_zbud_curr_raw_pages);
-out:
-	return ret;
+	freed = zbud_evict_pages(nr);
+	spin_unlock(&zcache_direct_reclaim_lock);
+
+	return max(count - freed, 0);
 }
 
 static struct shrinker zcache_shrinker = {
@@ -1230,7 +1309,9 @@ static int zcache_put_page(int pool_id, struct tmem_oid *oidp,
 				zcache_failed_eph_puts++;
 			else
 				zcache_failed_pers_puts++;
-		}
+			zcache_pool_stats[pool_id].failed_puts++;
+		} else
+			zcache_pool_stats[pool_id].puts++;
 		zcache_put_pool(pool);
 		preempt_enable_no_resched();
 	} else {
@@ -1256,6 +1337,10 @@ static int zcache_get_page(int pool_id, struct tmem_oid *oidp,
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_get(pool, oidp, index, page);
+		if (ret >= 0)
+			zcache_pool_stats[pool_id].hits++;
+		else
+			zcache_pool_stats[pool_id].misses++;
 		zcache_put_pool(pool);
 	}
 	local_irq_restore(flags);
@@ -1274,6 +1359,8 @@ static int zcache_flush_page(int pool_id, struct tmem_oid *oidp, uint32_t index)
 	if (likely(pool != NULL)) {
 		if (atomic_read(&pool->obj_count) > 0)
 			ret = tmem_flush_page(pool, oidp, index);
+		if (ret >= 0)
+			zcache_pool_stats[pool_id].flushes++;
 		zcache_put_pool(pool);
 	}
 	if (ret >= 0)
@@ -1346,6 +1433,7 @@ static int zcache_new_pool(uint32_t flags)
 		goto out;
 	}
 	atomic_set(&pool->refcount, 0);
+	memset(&zcache_pool_stats[poolid], 0, sizeof(zcache_pool_stats[poolid]));
 	pool->client = &zcache_client;
 	pool->pool_id = poolid;
 	tmem_new_pool(pool, flags);
@@ -0,0 +1,300 @@
+/*
+ * Compression streams for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/gfp.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+
+#include "zcomp.h"
+
+/*
+ * Algorithms offered through the comp_algorithm sysfs node. Any
+ * other compressor registered with the crypto API is accepted too.
+ */
+static const char * const backends[] = {
+	"lzo",
+	"lz4",
+	NULL
+};
+
+bool zcomp_available_algorithm(const char *comp)
+{
+	return crypto_has_comp(comp, 0, 0) == 1;
+}
+
+/* show available compressors, the selected one in brackets */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; backends[i]; i++) {
+		if (!strcmp(comp, backends[i]))
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"[%s] ", backends[i]);
+		else
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"%s ", backends[i]);
+	}
+	sz += scnprintf(buf + sz, PAGE_SIZE - sz, "\n");
+
+	return sz;
+}
+
+static void zcomp_strm_free(struct zcomp_strm *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * crypto_alloc_comp() allocates with GFP_KERNEL, so streams are only
+ * ever created from process context: at init time or from sysfs.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(comp->name, 0, 0);
+	/*
+	 * Allocate 2 pages: compressed output of an incompressible
+	 * page may be larger than PAGE_SIZE.
+	 */
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zcomp_strm_free(zstrm);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&zstrm->list);
+	return zstrm;
+}
+
+/*
+ * Get an idle stream, sleeping until one is released if all of them
+ * are busy. Never allocates and never returns NULL.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_entry(comp->idle_strm.next,
+					struct zcomp_strm, list);
+			list_del(&zstrm->list);
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+		spin_unlock(&comp->strm_lock);
+		wait_event(comp->strm_wait, !list_empty(&comp->idle_strm));
+	}
+}
+
+/*
+ * Return a stream to the idle list, or free it if max_strm has been
+ * lowered in the meantime.
+ */
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	comp->avail_strm--;
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(zstrm);
+}
+
+/*
+ * Raising the limit allocates the extra streams here, in process
+ * context, so that the write path never has to. Either all of them
+ * are added or none is and -ENOMEM is returned.
+ */
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	struct zcomp_strm *zstrm, *tmp;
+	LIST_HEAD(new_strm);
+	int avail, added = 0;
+
+	if (num_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	avail = comp->avail_strm;
+	spin_unlock(&comp->strm_lock);
+
+	/* Callers are serialized by zram->init_lock */
+	while (avail + added < num_strm) {
+		zstrm = zcomp_strm_alloc(comp);
+		if (!zstrm) {
+			list_for_each_entry_safe(zstrm, tmp, &new_strm, list)
+				zcomp_strm_free(zstrm);
+			return -ENOMEM;
+		}
+		list_add(&zstrm->list, &new_strm);
+		added++;
+	}
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = num_strm;
+	comp->avail_strm += added;
+	list_splice(&new_strm, &comp->idle_strm);
+	/* Drop idle streams above the new limit */
+	while (comp->avail_strm > num_strm &&
+			!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		comp->avail_strm--;
+		spin_unlock(&comp->strm_lock);
+		zcomp_strm_free(zstrm);
+		spin_lock(&comp->strm_lock);
+	}
+	spin_unlock(&comp->strm_lock);
+	wake_up_all(&comp->strm_wait);
+
+	return 0;
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	int ret;
+	unsigned int dlen = PAGE_SIZE * 2;
+
+	ret = crypto_comp_compress(zstrm->tfm, src, PAGE_SIZE,
+			zstrm->buffer, &dlen);
+	*dst_len = dlen;
+
+	return ret;
+}
+
+/*
+ * Called with preemption disabled (under kmap_atomic), which keeps
+ * this CPU's transform to ourselves.
+ */
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	int ret;
+	unsigned int dlen = PAGE_SIZE;
+	struct crypto_comp *tfm;
+
+	tfm = *get_cpu_ptr(comp->dtfm);
+	ret = crypto_comp_decompress(tfm, src, src_len, dst, &dlen);
+	put_cpu_ptr(comp->dtfm);
+
+	return ret;
+}
+
+static void zcomp_free_dtfms(struct zcomp *comp)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = *per_cpu_ptr(comp->dtfm, cpu);
+
+		if (!IS_ERR_OR_NULL(tfm))
+			crypto_free_comp(tfm);
+	}
+	free_percpu(comp->dtfm);
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	while (!list_empty(&comp->idle_strm)) {
+		zstrm = list_entry(comp->idle_strm.next,
+				struct zcomp_strm, list);
+		list_del(&zstrm->list);
+		zcomp_strm_free(zstrm);
+	}
+	if (comp->dtfm)
+		zcomp_free_dtfms(comp);
+	kfree(comp);
+}
+
+/*
+ * All max_strm streams are allocated here. If memory is short we make
+ * do with fewer, as long as there is at least one.
+ */
+struct zcomp *zcomp_create(const char *compress, int max_strm)
+{
+	int cpu;
+	struct zcomp *comp;
+	struct zcomp_strm *zstrm;
+
+	if (!zcomp_available_algorithm(compress))
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	strlcpy(comp->name, compress, sizeof(comp->name));
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max(max_strm, 1);
+
+	comp->dtfm = alloc_percpu(struct crypto_comp *);
+	if (!comp->dtfm)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = crypto_alloc_comp(compress, 0, 0);
+
+		*per_cpu_ptr(comp->dtfm, cpu) = tfm;
+		if (IS_ERR(tfm))
+			goto fail;
+	}
+
+	while (comp->avail_strm < comp->max_strm) {
+		zstrm = zcomp_strm_alloc(comp);
+		if (!zstrm)
+			break;
+		list_add(&zstrm->list, &comp->idle_strm);
+		comp->avail_strm++;
+	}
+	if (!comp->avail_strm)
+		goto fail;
+	if (comp->avail_strm < comp->max_strm) {
+		pr_warn("%s: only %d of %d compression streams allocated\n",
+			compress, comp->avail_strm, comp->max_strm);
+		comp->max_strm = comp->avail_strm;
+	}
+
+	return comp;
+
+fail:
+	zcomp_destroy(comp);
+	return NULL;
+}
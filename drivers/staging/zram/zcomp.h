@@ -0,0 +1,69 @@
+/*
+ * Compression streams for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define ZCOMP_NAME_LEN		CRYPTO_MAX_ALG_NAME
+
+/*
+ * A compression stream: a crypto transform holding the private working
+ * memory of the compressor, plus an output buffer large enough for the
+ * worst case expansion of one page.
+ */
+struct zcomp_strm {
+	struct crypto_comp *tfm;
+	void *buffer;
+	struct list_head list;
+};
+
+/*
+ * Pool of compression streams. All max_strm streams are allocated up
+ * front and recycled through the idle list; the write path never
+ * allocates. A writer that finds no idle stream sleeps on strm_wait.
+ */
+struct zcomp {
+	spinlock_t strm_lock;		/* protects idle_strm, avail_strm */
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;			/* streams allocated */
+	int max_strm;
+
+	/*
+	 * Decompression needs no stream: each CPU has its own transform,
+	 * so readers never wait for a writer.
+	 */
+	struct crypto_comp * __percpu *dtfm;
+	char name[ZCOMP_NAME_LEN];
+};
+
+bool zcomp_available_algorithm(const char *comp);
+ssize_t zcomp_available_show(const char *comp, char *buf);
+
+struct zcomp *zcomp_create(const char *comp, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+int zcomp_set_max_streams(struct zcomp *comp, int num_strm);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * Compressed RAM block device: same-content page deduplication
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Every stored object gets a checksum of its uncompressed content and
+ * is indexed in one of several rbtrees picked by that checksum. A write
+ * whose checksum matches an existing object is compared against the
+ * decompressed object and, if identical, just takes a reference to it.
+ * This catches pattern filled buffers and pages shared by forked
+ * processes (e.g. zygote children) which page_zero_filled() misses.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket (rbtree + lock) per this many pages of disksize */
+#define ZRAM_HASH_SHIFT		10
+#define ZRAM_HASH_SIZE_MIN	(1 << 4)
+#define ZRAM_HASH_SIZE_MAX	(1 << 10)
+
+u32 zram_calc_checksum(unsigned char *mem)
+{
+	return jhash2((const u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_checksum_to_hash(struct zram *zram,
+					u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+/*
+ * Compare a stored object with the content of a page. The object is
+ * decompressed into the buffer of the caller's compression stream.
+ */
+static bool zram_dedup_match(struct zram *zram, struct zram_entry *entry,
+			struct page *page, struct zcomp_strm *zstrm)
+{
+	int ret = 0;
+	bool match;
+	unsigned char *cmem, *user_mem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	if (entry->len == PAGE_SIZE) {
+		match = !memcmp(cmem, user_mem, PAGE_SIZE);
+	} else {
+		ret = zcomp_decompress(zram->comp, cmem, entry->len,
+					zstrm->buffer);
+		match = !ret && !memcmp(zstrm->buffer, user_mem, PAGE_SIZE);
+	}
+
+	kunmap_atomic(user_mem, KM_USER0);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for an object with the same content as the given page. On
+ * success, a new reference to it is returned.
+ *
+ * Only the first object with a matching checksum is compared: a
+ * checksum collision merely costs a missed dedup opportunity. The
+ * comparison is done under the bucket lock so that refcount always
+ * equals the number of table entries using the object.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, struct page *page,
+				u32 checksum, struct zcomp_strm *zstrm)
+{
+	struct zram_hash *hash = zram_checksum_to_hash(zram, checksum);
+	struct rb_node *rb_node;
+	struct zram_entry *entry = NULL;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		struct zram_entry *cur;
+
+		cur = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == cur->checksum) {
+			if (zram_dedup_match(zram, cur, page, zstrm)) {
+				cur->refcount++;
+				entry = cur;
+			}
+			break;
+		}
+
+		rb_node = checksum < cur->checksum ?
+				rb_node->rb_left : rb_node->rb_right;
+	}
+	spin_unlock(&hash->lock);
+
+	return entry;
+}
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+				u32 checksum)
+{
+	struct zram_hash *hash = zram_checksum_to_hash(zram, checksum);
+	struct rb_node **rb_node, *parent = NULL;
+
+	new->checksum = checksum;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		struct zram_entry *cur;
+
+		parent = *rb_node;
+		cur = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < cur->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+struct zram_entry *zram_entry_alloc(struct zram *zram, unsigned long handle,
+				unsigned int len)
+{
+	struct zram_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->checksum = 0;
+	entry->refcount = 1;
+	entry->handle = handle;
+	entry->len = len;
+
+	return entry;
+}
+
+/*
+ * Drop a reference to the object. Returns true if this was the last
+ * one, in which case the object has been freed.
+ */
+bool zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	int refcount;
+
+	/* Objects outside the index cannot gain new references */
+	if (RB_EMPTY_NODE(&entry->rb_node)) {
+		refcount = --entry->refcount;
+	} else {
+		hash = zram_checksum_to_hash(zram, entry->checksum);
+
+		spin_lock(&hash->lock);
+		refcount = --entry->refcount;
+		if (!refcount)
+			rb_erase(&entry->rb_node, &hash->rb_root);
+		spin_unlock(&hash->lock);
+	}
+
+	WARN_ON(refcount < 0);
+	if (refcount)
+		return false;
+
+	zs_free(zram->mem_pool, entry->handle);
+	kfree(entry);
+
+	return true;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	int i;
+
+	zram->hash_size = num_pages >> ZRAM_HASH_SHIFT;
+	zram->hash_size = clamp_t(size_t, zram->hash_size,
+				ZRAM_HASH_SIZE_MIN, ZRAM_HASH_SIZE_MAX);
+	zram->hash_size = rounddown_pow_of_two(zram->hash_size);
+
+	zram->hash = vzalloc(zram->hash_size * sizeof(struct zram_hash));
+	if (!zram->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		zram->hash[i].rb_root = RB_ROOT;
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Compressed RAM block device: same-content page deduplication
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_DEDUP_H_
+#define _ZRAM_DEDUP_H_
+
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
+struct zram;
+struct zcomp_strm;
+
+/*
+ * A stored object. Table entries point to one of these rather than
+ * directly to the zsmalloc handle, so that any number of table entries
+ * holding the same content can share a single object.
+ */
+struct zram_entry {
+	struct rb_node rb_node;	/* in zram->hash[], if dedup is enabled */
+	u32 checksum;
+	int refcount;		/* protected by the hash bucket lock */
+	unsigned long handle;
+	u16 len;		/* object size in bytes */
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
+u32 zram_calc_checksum(unsigned char *mem);
+struct zram_entry *zram_dedup_find(struct zram *zram, struct page *page,
+				u32 checksum, struct zcomp_strm *zstrm);
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+				u32 checksum);
+
+struct zram_entry *zram_entry_alloc(struct zram *zram, unsigned long handle,
+				unsigned int len);
+bool zram_entry_put(struct zram *zram, struct zram_entry *entry);
+
+int zram_dedup_init(struct zram *zram, size_t num_pages);
+void zram_dedup_fini(struct zram *zram);
+
+#endif
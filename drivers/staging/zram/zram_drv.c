@@ -22,6 +22,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/bio.h>
+#include <linux/bitmap.h>
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
@@ -29,9 +30,9 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -42,14 +43,14 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(atomic_t *v)
 {
-	*v = *v + 1;
+	atomic_inc(v);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(atomic_t *v)
 {
-	*v = *v - 1;
+	atomic_dec(v);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -133,15 +134,61 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+/*
+ * Drop a table entry's reference to its object.
+ * Must be called with tb_lock held for writing.
+ */
+static void zram_release_entry(struct zram *zram, struct zram_entry *entry)
+{
+	u16 len = entry->len;
+
+	if (!zram_entry_put(zram, entry)) {
+		/* Other pages still share this object */
+		zram_stat_dec(&zram->stats.pages_dedup);
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, len);
+		return;
+	}
+
+	if (unlikely(len > max_zpage_size))
+		zram_stat_dec(&zram->stats.pages_expand);
+	else if (len <= PAGE_SIZE / 2)
+		zram_stat_dec(&zram->stats.good_compress);
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, len);
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void free_block_bdev(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bitmap_lock);
+	WARN_ON(!test_bit(blk, zram->bdev_bitmap));
+	clear_bit(blk, zram->bdev_bitmap);
+	spin_unlock(&zram->bitmap_lock);
+}
+#endif
+
+/*
+ * Free memory associated with the given table entry.
+ * Must be called with tb_lock held for writing.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry = zram->table[index].entry;
+
+	/* Access and writeback state go away with the content */
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		free_block_bdev(zram, zram->table[index].bdev_blk);
+		zram_stat_dec(&zram->stats.bd_count);
+		goto out;
+	}
+#endif
 
-	if (unlikely(!page)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,30 +200,360 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+	zram_release_entry(zram, entry);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+out:
+#endif
+	zram_stat_dec(&zram->stats.pages_stored);
+	zram->table[index].entry = NULL;
+}
+
+/*
+ * Decompress a stored object into a page.
+ * Must be called with tb_lock held.
+ */
+static int zram_decompress_entry(struct zram *zram,
+			struct zram_entry *entry, struct page *page)
+{
+	int ret = 0;
+	unsigned char *user_mem, *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	user_mem = kmap_atomic(page, KM_USER0);
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(entry->len == PAGE_SIZE))
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = zcomp_decompress(zram->comp, cmem, entry->len,
+					user_mem);
+
+	kunmap_atomic(user_mem, KM_USER0);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return ret;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Writeback moves pages to the backing device this many at a time */
+#define ZRAM_WB_BATCH	32
+
+/*
+ * Allocate nr contiguous blocks on the backing device so that a
+ * writeback batch goes out as a single bio. Returns the first block,
+ * or -ENOSPC.
+ */
+static long alloc_blocks_bdev(struct zram *zram, unsigned int nr)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bitmap_lock);
+	blk = bitmap_find_next_zero_area(zram->bdev_bitmap,
+				zram->nr_bdev_pages, 0, nr, 0);
+	if (blk >= zram->nr_bdev_pages) {
+		spin_unlock(&zram->bitmap_lock);
+		return -ENOSPC;
+	}
+	bitmap_set(zram->bdev_bitmap, blk, nr);
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk;
+}
+
+static void zram_bdev_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Synchronous I/O of nr pages to/from consecutive blocks of the
+ * backing device, starting at blk.
+ */
+static int zram_bdev_rw(struct zram *zram, int rw, struct page **pages,
+			unsigned int nr, unsigned long blk)
+{
+	int i, ret = 0;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, nr);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bdev_end_io;
+	bio->bi_private = &done;
+
+	for (i = 0; i < nr; i++) {
+		if (!bio_add_page(bio, pages[i], PAGE_SIZE, 0)) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	submit_bio(rw | REQ_SYNC, bio);
+	wait_for_completion(&done);
+
+	if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		ret = -EIO;
+out:
+	bio_put(bio);
+	return ret;
+}
+
+struct zram_bdev_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bdev_read_work(struct work_struct *work)
+{
+	struct zram_bdev_work *zw = container_of(work,
+					struct zram_bdev_work, work);
+
+	zw->ret = zram_bdev_rw(zw->zram, READ, &zw->page, 1, zw->blk);
+}
+
+/*
+ * Read a written back page. From within zram_make_request() the bio
+ * we submit would only be queued on current->bio_list and never
+ * issued while we wait for it, so hand it to a worker in that case.
+ */
+static int read_from_bdev(struct zram *zram, struct page *page,
+			unsigned long blk)
+{
+	struct zram_bdev_work zw;
+
+	if (!current->bio_list)
+		return zram_bdev_rw(zram, READ, &page, 1, blk);
+
+	zw.zram = zram;
+	zw.page = page;
+	zw.blk = blk;
+	INIT_WORK_ONSTACK(&zw.work, zram_bdev_read_work);
+	queue_work(system_unbound_wq, &zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	return zw.ret;
+}
+
+/*
+ * Mark every stored page idle. Pages read or written after this
+ * lose the mark again, so a later writeback of idle pages only
+ * picks up those that were not touched in the meantime.
+ */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->tb_lock);
+		if (zram->table[index].entry &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->tb_lock);
+	}
+}
+
+/*
+ * Take a snapshot of the page at index for writeback, if it matches
+ * mode. The slot is tagged ZRAM_UNDER_WB: if it is overwritten or
+ * freed before the write completes, the tag is gone and the copy on
+ * the backing device is simply dropped.
+ */
+static bool zram_wb_prepare(struct zram *zram, size_t index,
+			enum zram_wb_mode mode, struct page *page)
+{
+	bool ret = false;
+	struct zram_entry *entry;
+
+	write_lock(&zram->tb_lock);
+	entry = zram->table[index].entry;
+	if (!entry || zram_test_flag(zram, index, ZRAM_WB) ||
+			zram_test_flag(zram, index, ZRAM_UNDER_WB))
+		goto out;
+
+	if (mode == ZRAM_WB_IDLE && !zram_test_flag(zram, index, ZRAM_IDLE))
+		goto out;
+	if (mode == ZRAM_WB_HUGE && entry->len != PAGE_SIZE)
+		goto out;
+
+	if (unlikely(zram_decompress_entry(zram, entry, page)))
 		goto out;
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	ret = true;
+out:
+	write_unlock(&zram->tb_lock);
+	return ret;
+}
+
+/*
+ * Point the slot at its block on the backing device and free the
+ * in-memory object, unless the slot changed while we were writing.
+ */
+static void zram_wb_finish(struct zram *zram, size_t index,
+			unsigned long blk, bool success)
+{
+	write_lock(&zram->tb_lock);
+	if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		write_unlock(&zram->tb_lock);
+		free_block_bdev(zram, blk);
+		return;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+	if (!success) {
+		write_unlock(&zram->tb_lock);
+		free_block_bdev(zram, blk);
+		return;
+	}
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	/* pages_stored is unchanged: the page is still on this device */
+	zram_release_entry(zram, zram->table[index].entry);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram->table[index].bdev_blk = blk;
+	zram_set_flag(zram, index, ZRAM_WB);
+	write_unlock(&zram->tb_lock);
+
+	zram_stat_inc(&zram->stats.bd_count);
+}
+
+/*
+ * Move pages selected by mode to the backing device, in batches of
+ * up to ZRAM_WB_BATCH pages written to contiguous blocks.
+ * Called with init_lock held on an initialized device.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int i, nr, ret = 0;
+	long blk;
+	size_t index = 0, num_pages;
+	size_t batch[ZRAM_WB_BATCH];
+	struct page *pages[ZRAM_WB_BATCH] = { NULL };
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	while (index < num_pages) {
+		nr = 0;
+		for (; index < num_pages && nr < ZRAM_WB_BATCH; index++) {
+			if (zram_wb_prepare(zram, index, mode, pages[nr]))
+				batch[nr++] = index;
+		}
+		if (!nr)
+			break;
+
+		blk = alloc_blocks_bdev(zram, nr);
+		if (blk < 0) {
+			/* Backing device is full: put the batch back */
+			for (i = 0; i < nr; i++) {
+				write_lock(&zram->tb_lock);
+				zram_clear_flag(zram, batch[i], ZRAM_UNDER_WB);
+				write_unlock(&zram->tb_lock);
+			}
+			ret = blk;
+			break;
+		}
+
+		ret = zram_bdev_rw(zram, WRITE, pages, nr, blk);
+		for (i = 0; i < nr; i++)
+			zram_wb_finish(zram, batch[i], blk + i, !ret);
+		if (ret) {
+			pr_err("Writeback to backing device failed! "
+				"err=%d\n", ret);
+			break;
+		}
+
+		zram_stat64_add(zram, &zram->stats.bd_writes, nr);
+	}
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	for (i = 0; i < ZRAM_WB_BATCH && pages[i]; i++)
+		__free_page(pages[i]);
+
+	return ret;
+}
+
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	vfree(zram->bdev_bitmap);
+	zram->bdev_bitmap = NULL;
+	zram->nr_bdev_pages = 0;
+	zram->backing_dev[0] = '\0';
 }
 
+/*
+ * Attach the block device at path as backing store. A regular file
+ * can be used through a loop device.
+ * Called with init_lock held on an uninitialized device.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	int ret;
+	unsigned long nr_pages;
+	unsigned long *bitmap;
+	struct block_device *bdev;
+
+	zram_reset_bdev(zram);
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE |
+					FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		pr_err("Cannot open backing device %s\n", path);
+		return PTR_ERR(bdev);
+	}
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto fail;
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!nr_pages) {
+		ret = -EINVAL;
+		goto fail;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	zram->bdev = bdev;
+	zram->bdev_bitmap = bitmap;
+	zram->nr_bdev_pages = nr_pages;
+	strlcpy(zram->backing_dev, path, sizeof(zram->backing_dev));
+
+	pr_info("Using backing device %s (%lu pages)\n", path, nr_pages);
+	return 0;
+
+fail:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	return ret;
+}
+#endif
+
 static void handle_zero_page(struct page *page)
 {
 	void *user_mem;
@@ -188,86 +565,80 @@ static void handle_zero_page(struct page *page)
 	flush_dcache_page(page);
 }
 
-static void handle_uncompressed_page(struct zram *zram,
-				struct page *page, u32 index)
+/*
+ * Read one page. Called with tb_lock held for reading; returns with
+ * it held, but may drop it to fetch the page from the backing device.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
-	unsigned char *user_mem, *cmem;
+	struct zram_entry *entry;
 
-	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		handle_zero_page(page);
+		return 0;
+	}
 
-	memcpy(user_mem, cmem, PAGE_SIZE);
-	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
+	/* This page has been accessed: it is no longer idle */
+	clear_bit(ZRAM_IDLE, &zram->table[index].flags);
 
-	flush_dcache_page(page);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		int ret;
+		unsigned long blk = zram->table[index].bdev_blk;
+
+		/*
+		 * The block stays allocated until this slot is
+		 * overwritten or discarded, which the owner of the
+		 * device does not do while a read is in flight.
+		 */
+		read_unlock(&zram->tb_lock);
+		ret = read_from_bdev(zram, page, blk);
+		if (!ret)
+			zram_stat64_inc(zram, &zram->stats.bd_reads);
+		read_lock(&zram->tb_lock);
+		return ret;
+	}
+#endif
+
+	entry = zram->table[index].entry;
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!entry)) {
+		pr_debug("Read before write: page=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	return zram_decompress_entry(zram, entry, page);
 }
 
 static void zram_read(struct zram *zram, struct bio *bio)
 {
-
-	int i;
+	int i, ret;
 	u32 index;
 	struct bio_vec *bvec;
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
+	/*
+	 * tb_lock is taken per page: a decompression is the expensive
+	 * part of a read, and holding the lock across several of them
+	 * would only make writers wait longer.
+	 */
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
-
-		page = bvec->bv_page;
-
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
-
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
-
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
-		}
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
-
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
-
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		read_lock(&zram->tb_lock);
+		ret = zram_read_page(zram, bvec->bv_page, index);
+		read_unlock(&zram->tb_lock);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
+		if (unlikely(ret)) {
+			pr_err("Read failed! err=%d, page=%u\n", ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
 
-		flush_dcache_page(page);
+		flush_dcache_page(bvec->bv_page);
 		index++;
 	}
 
@@ -279,130 +650,188 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+/*
+ * Compress a page into a new object. The caller owns zstrm.
+ */
+static struct zram_entry *zram_compress_page(struct zram *zram,
+			struct zcomp_strm *zstrm, struct page *page, u32 index)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	int ret;
+	size_t clen;
+	unsigned long handle;
+	struct zram_entry *entry;
+	unsigned char *user_mem, *cmem;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	user_mem = kmap_atomic(page, KM_USER0);
+	ret = zcomp_compress(zram->comp, zstrm, user_mem, &clen);
+	kunmap_atomic(user_mem, KM_USER0);
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	if (unlikely(ret)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		return NULL;
+	}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size))
+		clen = PAGE_SIZE;
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	handle = zs_malloc(zram->mem_pool, clen);
+	if (!handle) {
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, clen);
+		return NULL;
+	}
 
-		mutex_lock(&zram->lock);
+	entry = zram_entry_alloc(zram, handle, clen);
+	if (!entry) {
+		zs_free(zram->mem_pool, handle);
+		return NULL;
+	}
 
+	/*
+	 * The new object is not visible to anyone yet, so it can
+	 * be filled in without holding tb_lock.
+	 */
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	if (unlikely(clen == PAGE_SIZE)) {
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
-			continue;
-		}
+		memcpy(cmem, user_mem, PAGE_SIZE);
+		kunmap_atomic(user_mem, KM_USER0);
+	} else {
+		memcpy(cmem, zstrm->buffer, clen);
+	}
+	zs_unmap_object(zram->mem_pool, handle);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	/* Update stats */
+	if (unlikely(clen == PAGE_SIZE))
+		zram_stat_inc(&zram->stats.pages_expand);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
+	return entry;
+}
+
+/*
+ * Prepare the object for one written page, without touching the
+ * table. *entry is left NULL for a zero filled page. The compression
+ * stream is only looked up the first time one is needed, and then
+ * kept for the rest of the bio.
+ */
+static int zram_prepare_page(struct zram *zram, struct zcomp_strm **zstrm,
+			struct page *page, u32 index, struct zram_entry **entry)
+{
+	u32 checksum = 0;
+	unsigned char *user_mem;
+
+	*entry = NULL;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(user_mem)) {
 		kunmap_atomic(user_mem, KM_USER0);
+		return 0;
+	}
+	if (zram->use_dedup)
+		checksum = zram_calc_checksum(user_mem);
+	kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
-		}
+	/* May sleep waiting for a stream, so not under kmap_atomic */
+	if (!*zstrm)
+		*zstrm = zcomp_strm_find(zram->comp);
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+	if (zram->use_dedup)
+		*entry = zram_dedup_find(zram, page, checksum, *zstrm);
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+	if (*entry) {
+		zram_stat_inc(&zram->stats.pages_dedup);
+		zram_stat64_add(zram, &zram->stats.dup_data_size,
+				(*entry)->len);
+		return 0;
+	}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+	*entry = zram_compress_page(zram, *zstrm, page, index);
+	if (unlikely(!*entry))
+		return -ENOMEM;
+
+	if (zram->use_dedup)
+		zram_dedup_insert(zram, *entry, checksum);
+
+	return 0;
+}
+
+/*
+ * Publish nr prepared pages starting at index, dropping the objects
+ * they replace, under a single acquisition of tb_lock.
+ */
+static void zram_publish(struct zram *zram, u32 index,
+			struct zram_entry **entries, int nr)
+{
+	int i, zero = 0;
+
+	write_lock(&zram->tb_lock);
+	for (i = 0; i < nr; i++, index++) {
+		zram_free_page(zram, index);
+		if (entries[i]) {
+			zram->table[index].entry = entries[i];
+		} else {
+			/*
+			 * System overwrites unused sectors. Memory
+			 * associated with this sector is freed above.
+			 */
+			zram_set_flag(zram, index, ZRAM_ZERO);
+			zero++;
 		}
+	}
+	write_unlock(&zram->tb_lock);
+
+	atomic_add(zero, &zram->stats.pages_zero);
+	atomic_add(nr - zero, &zram->stats.pages_stored);
+}
 
-memstore:
-		zram->table[index].offset = offset;
+static void zram_write(struct zram *zram, struct bio *bio)
+{
+	int i, ret = 0, nr = 0;
+	u32 index;
+	struct bio_vec *bvec;
+	struct zcomp_strm *zstrm = NULL;
+	struct zram_entry *entries[ZRAM_BIO_BATCH];
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	zram_stat64_inc(zram, &zram->stats.num_writes);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+	bio_for_each_segment(bvec, bio, i) {
+		ret = zram_prepare_page(zram, &zstrm, bvec->bv_page,
+					index + nr, &entries[nr]);
+		if (unlikely(ret)) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			break;
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+		if (++nr == ZRAM_BIO_BATCH) {
+			zram_publish(zram, index, entries, nr);
+			index += nr;
+			nr = 0;
+		}
+	}
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	/* Pages prepared before a failure are still written */
+	if (nr)
+		zram_publish(zram, index, entries, nr);
 
-		mutex_unlock(&zram->lock);
-		index++;
+	if (unlikely(ret)) {
+		bio_io_error(bio);
+		return;
 	}
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
-	return;
-
-out:
-	bio_io_error(bio);
 }
 
 /*
@@ -410,8 +839,14 @@ out:
  */
 static inline int valid_io_request(struct zram *zram, struct bio *bio)
 {
+	u64 end = bio->bi_sector + (bio->bi_size >> SECTOR_SHIFT);
+
+	/*
+	 * The whole bio is checked here, so that the read and write
+	 * loops need no per-page bounds checks.
+	 */
 	if (unlikely(
-		(bio->bi_sector >= (zram->disksize >> SECTOR_SHIFT)) ||
+		(end > (zram->disksize >> SECTOR_SHIFT)) ||
 		(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
 		(bio->bi_size & (PAGE_SIZE - 1)))) {
 
@@ -460,34 +895,33 @@ void zram_reset_device(struct zram *zram)
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free compression streams */
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	for (index = 0; zram->table &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		struct zram_entry *entry = zram->table[index].entry;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (!entry || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_entry_put(zram, entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_fini(zram);
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	zram_reset_bdev(zram);
+#endif
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,19 +945,14 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error initializing %s compressor\n", zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
+	/* zcomp_create() may have settled for fewer streams */
+	zram->max_comp_streams = zram->comp->max_strm;
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +964,16 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret)
+		goto fail;
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +999,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1014,16 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->tb_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
+	zram->max_comp_streams = default_comp_streams_per_cpu *
+					num_online_cpus();
+	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
+	zram->use_dedup = 1;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
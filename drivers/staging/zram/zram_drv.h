@@ -18,7 +18,9 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +28,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -51,9 +41,28 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * Default limit on the number of concurrent compression streams
+ * per device, as a multiple of online CPUs. Can be changed through
+ * the max_comp_streams sysfs node.
+ */
+static const unsigned default_comp_streams_per_cpu = 2;
+
+/*
+ * Multi-page write bios are published this many pages at a time under
+ * one acquisition of tb_lock for writing.
+ */
+#define ZRAM_BIO_BATCH		16
+
+/*
+ * Default compression algorithm. Any compressor registered with the
+ * crypto API can be selected per device through comp_algorithm.
  */
+static const char * const default_compressor = "lzo";
 
 /*-- End of configurable params */
 
@@ -63,26 +72,41 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
 #define ZRAM_LOGICAL_BLOCK_SIZE	4096
 
-/* Flags for zram pages (table[page_no].flags) */
+/*
+ * Flags for zram pages (table[page_no].flags). Pages stored uncompressed
+ * are recognized by table[page_no].entry->len == PAGE_SIZE.
+ */
 enum zram_pageflags {
-	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
-
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page not accessed since the device was last marked idle */
+	ZRAM_IDLE,
+
+	/* Page is stored on the backing device, at table[].bdev_blk */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
-/* Allocated for each disk page */
+/*
+ * Allocated for each disk page. The reference count of an object
+ * shared by several disk pages lives in its zram_entry.
+ */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
-} __attribute__((aligned(4)));
+	union {
+		struct zram_entry *entry;	/* NULL if not stored */
+		unsigned long bdev_blk;		/* if ZRAM_WB is set */
+	};
+	unsigned long flags;	/* ZRAM_IDLE may be cleared with only
+				 * tb_lock held for reading, hence the
+				 * atomic bitops friendly type */
+};
 
 struct zram_stats {
 	u64 compr_size;		/* compressed size of pages stored */
@@ -92,20 +116,28 @@ struct zram_stats {
 	u64 failed_writes;	/* can happen when memory is too low */
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 dup_data_size;	/* compressed bytes saved by dedup */
+	atomic_t pages_zero;	/* no. of zero filled pages */
+	atomic_t pages_dedup;	/* no. of pages sharing another's object */
+	atomic_t pages_stored;	/* no. of pages currently stored */
+	atomic_t good_compress;	/* % of pages with compression ratio<=50% */
+	atomic_t pages_expand;	/* % of incompressible pages */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic_t bd_count;	/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from backing device */
+	u64 bd_writes;		/* no. of pages written to backing device */
+#endif
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t tb_lock;	/* protect table entries; readers never
+				 * wait for a compression in progress */
+	struct zram_hash *hash;	/* index of stored objects for dedup */
+	size_t hash_size;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +148,16 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	int max_comp_streams;
+	char compressor[ZCOMP_NAME_LEN];
+	int use_dedup;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct block_device *bdev;	/* backing device, if any */
+	char backing_dev[64];
+	unsigned long nr_bdev_pages;
+	unsigned long *bdev_bitmap;	/* allocated backing blocks */
+	spinlock_t bitmap_lock;
+#endif
 
 	struct zram_stats stats;
 };
@@ -129,4 +171,16 @@ extern struct attribute_group zram_disk_attr_group;
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/* Modes for zram_writeback() */
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,	/* pages not accessed since zram_mark_idle() */
+	ZRAM_WB_HUGE,	/* pages stored uncompressed */
+};
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
+
 #endif
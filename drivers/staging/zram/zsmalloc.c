@@ -0,0 +1,697 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are packed into zspages of a single size class, so the only
+ * internal fragmentation is the rounding up to the class size and the
+ * tail of each zspage. Users get an opaque handle instead of a
+ * <page, offset> pair, which lets zs_compact() migrate objects out of
+ * sparsely used zspages and give the pages back to the system.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cache;
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage that wastes the least space
+ * at the end of the zspage for objects of the given size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size, waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static struct size_class *zs_handle_class(struct zs_pool *pool,
+					struct zs_handle *handle)
+{
+	return &pool->size_class[handle->class_idx];
+}
+
+/*
+ * Get a zspage with free slots, preferring the most used ones so that
+ * sparse zspages get a chance to drain.
+ */
+static struct zspage *find_alloc_zspage(struct size_class *class)
+{
+	struct list_head *head;
+
+	head = &class->fullness_list[ZS_ALMOST_FULL];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	head = &class->fullness_list[ZS_ALMOST_EMPTY];
+	if (!list_empty(head))
+		return list_first_entry(head, struct zspage, list);
+
+	return NULL;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	int max_objects = class->objs_per_zspage;
+
+	if (zspage->inuse == 0)
+		return ZS_EMPTY;
+	if (zspage->inuse == max_objects)
+		return ZS_FULL;
+	if (zspage->inuse <= max_objects * (ZS_FULLNESS_THRESHOLD_FRAC - 1) /
+			ZS_FULLNESS_THRESHOLD_FRAC)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+/*
+ * Move zspage to the list matching its current fullness. Empty
+ * zspages are unlinked and left for the caller to free.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	/*
+	 * Recently touched zspages go to the head where allocations
+	 * look first; compaction drains from the tail.
+	 */
+	list_del_init(&zspage->list);
+	if (newfg != ZS_EMPTY)
+		list_add(&zspage->list, &class->fullness_list[newfg]);
+	zspage->fullness = newfg;
+
+	return newfg;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+
+	atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			sizeof(zspage->handles[0]), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->fullness = ZS_EMPTY;
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static unsigned int obj_alloc_slot(struct size_class *class,
+				struct zspage *zspage)
+{
+	unsigned int idx = zspage->free_hint;
+
+	while (zspage->handles[idx]) {
+		if (++idx == class->objs_per_zspage)
+			idx = 0;
+	}
+	zspage->free_hint = idx;
+
+	return idx;
+}
+
+/*
+ * Copy 'size' bytes between a buffer and the zspage, starting at
+ * 'offset', one page at a time.
+ */
+static void zs_copy(struct zspage *zspage, unsigned long offset,
+			char *buf, int size, int to_zspage)
+{
+	while (size) {
+		struct page *page = zspage->pages[offset >> PAGE_SHIFT];
+		unsigned long off = offset & ~PAGE_MASK;
+		int len = min_t(int, size, PAGE_SIZE - off);
+		char *addr;
+
+		addr = kmap_atomic(page, KM_USER1);
+		if (to_zspage)
+			memcpy(addr + off, buf, len);
+		else
+			memcpy(buf, addr + off, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		offset += len;
+		buf += len;
+		size -= len;
+	}
+}
+
+/*
+ * Copy an object between two zspages of the same class. Called
+ * during compaction with the class lock held.
+ */
+static void zs_move_object(struct size_class *class,
+			struct zspage *dst, unsigned int didx,
+			struct zspage *src, unsigned int sidx)
+{
+	unsigned long s_off = (unsigned long)sidx * class->size;
+	unsigned long d_off = (unsigned long)didx * class->size;
+	int size = class->size;
+
+	while (size) {
+		unsigned long s_pg_off = s_off & ~PAGE_MASK;
+		unsigned long d_pg_off = d_off & ~PAGE_MASK;
+		char *s_addr, *d_addr;
+		int len;
+
+		len = min_t(int, size, PAGE_SIZE - s_pg_off);
+		len = min_t(int, len, PAGE_SIZE - d_pg_off);
+
+		s_addr = kmap_atomic(src->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(dst->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_pg_off, s_addr + s_pg_off, len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += len;
+		d_off += len;
+		size -= len;
+	}
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing the pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, ovhd_size;
+	struct zs_pool *pool;
+
+	if (!name)
+		return NULL;
+
+	ovhd_size = roundup(sizeof(*pool), PAGE_SIZE);
+	pool = kzalloc(ovhd_size, GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+	}
+
+	pool->flags = flags;
+	pool->name = name;
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg])) {
+				pr_info("Freeing non-empty class with size "
+					"%db, fullness group %d\n",
+					class->size, fg);
+			}
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned int idx;
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cache,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	handle->class_idx = get_size_class_index(size);
+	class = zs_handle_class(pool, handle);
+
+	spin_lock(&class->lock);
+	zspage = find_alloc_zspage(class);
+
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, pool->flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+		atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	idx = obj_alloc_slot(class, zspage);
+	zspage->handles[idx] = handle;
+	zspage->inuse++;
+	class->obj_inuse++;
+	fix_fullness_group(class, zspage);
+
+	handle->zspage = zspage;
+	handle->idx = idx;
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fg;
+
+	if (unlikely(!handle))
+		return;
+
+	/*
+	 * The owner of the handle guarantees that it is not being freed
+	 * concurrently, so handle->zspage can only change under the
+	 * class lock (by compaction), never the class itself.
+	 */
+	class = zs_handle_class(pool, handle);
+
+	spin_lock(&class->lock);
+	zspage = handle->zspage;
+
+	/* Catch double free bugs */
+	BUG_ON(zspage->handles[handle->idx] != handle);
+
+	zspage->handles[handle->idx] = NULL;
+	zspage->inuse--;
+	class->obj_inuse--;
+	fg = fix_fullness_group(class, zspage);
+	if (fg == ZS_EMPTY)
+		class->zspages--;
+	spin_unlock(&class->lock);
+
+	if (fg == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+
+	kmem_cache_free(zs_handle_cache, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. There is no
+ * protection against nested mappings.
+ *
+ * This function returns with preemption and page faults disabled.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct mapping_area *area;
+	unsigned long off;
+
+	BUG_ON(!handle);
+
+	class = zs_handle_class(pool, handle);
+	area = &get_cpu_var(zs_map_area);
+
+	/* Pin the zspage so that compaction leaves it alone */
+	spin_lock(&class->lock);
+	area->zspage = handle->zspage;
+	area->zspage->mapcount++;
+	off = (unsigned long)handle->idx * class->size;
+	spin_unlock(&class->lock);
+
+	area->offset = off;
+	area->size = class->size;
+	area->vm_mm = mm;
+
+	if ((off & ~PAGE_MASK) + class->size <= PAGE_SIZE) {
+		/* this object is contained entirely within a page */
+		area->bounced = false;
+		area->vm_addr = kmap_atomic(
+				area->zspage->pages[off >> PAGE_SHIFT],
+				KM_USER1);
+		return area->vm_addr + (off & ~PAGE_MASK);
+	}
+
+	/* this object spans two pages */
+	area->bounced = true;
+	area->vm_addr = area->vm_buf;
+	if (mm != ZS_MM_WO)
+		zs_copy(area->zspage, off, area->vm_buf, area->size, 0);
+
+	return area->vm_addr;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct mapping_area *area;
+
+	BUG_ON(!handle);
+
+	class = zs_handle_class(pool, handle);
+	area = &__get_cpu_var(zs_map_area);
+
+	if (!area->bounced)
+		kunmap_atomic(area->vm_addr, KM_USER1);
+	else if (area->vm_mm != ZS_MM_RO)
+		zs_copy(area->zspage, area->offset, area->vm_buf,
+			area->size, 1);
+
+	spin_lock(&class->lock);
+	area->zspage->mapcount--;
+	spin_unlock(&class->lock);
+
+	put_cpu_var(zs_map_area);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Pick the least used zspage that can be drained: the tail of the
+ * ALMOST_EMPTY list, skipping zspages that have mapped objects.
+ */
+static struct zspage *find_source_zspage(struct size_class *class)
+{
+	struct zspage *zspage;
+
+	list_for_each_entry_reverse(zspage,
+			&class->fullness_list[ZS_ALMOST_EMPTY], list) {
+		if (!zspage->mapcount)
+			return zspage;
+	}
+
+	return NULL;
+}
+
+static struct zspage *find_target_zspage(struct size_class *class,
+					struct zspage *src)
+{
+	struct zspage *zspage;
+
+	list_for_each_entry(zspage,
+			&class->fullness_list[ZS_ALMOST_FULL], list)
+		return zspage;
+
+	list_for_each_entry(zspage,
+			&class->fullness_list[ZS_ALMOST_EMPTY], list) {
+		if (zspage != src)
+			return zspage;
+	}
+
+	return NULL;
+}
+
+/*
+ * Migrate all objects of one zspage into better used zspages of the
+ * same class. Returns the zspage if it became empty, NULL otherwise.
+ */
+static struct zspage *compact_zspage(struct size_class *class,
+				struct zspage *src)
+{
+	unsigned int sidx;
+	struct zspage *dst = NULL;
+
+	for (sidx = 0; sidx < class->objs_per_zspage; sidx++) {
+		unsigned int didx;
+		struct zs_handle *handle = src->handles[sidx];
+
+		if (!handle)
+			continue;
+
+		if (!dst || dst->inuse == class->objs_per_zspage) {
+			if (dst)
+				fix_fullness_group(class, dst);
+			dst = find_target_zspage(class, src);
+			if (!dst)
+				break;
+		}
+
+		didx = obj_alloc_slot(class, dst);
+		zs_move_object(class, dst, didx, src, sidx);
+
+		dst->handles[didx] = handle;
+		dst->inuse++;
+		src->handles[sidx] = NULL;
+		src->inuse--;
+
+		handle->zspage = dst;
+		handle->idx = didx;
+	}
+
+	if (dst)
+		fix_fullness_group(class, dst);
+
+	if (fix_fullness_group(class, src) == ZS_EMPTY) {
+		class->zspages--;
+		return src;
+	}
+
+	return NULL;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src, *empty;
+
+	spin_lock(&class->lock);
+	while ((src = find_source_zspage(class))) {
+		/*
+		 * Draining is only worthwhile if the live objects of
+		 * this class would fit in fewer zspages.
+		 */
+		if (class->obj_inuse > (class->zspages - 1) *
+				class->objs_per_zspage)
+			break;
+
+		empty = compact_zspage(class, src);
+		if (!empty)
+			break;
+
+		spin_unlock(&class->lock);
+		free_zspage(pool, class, empty);
+		freed += class->pages_per_zspage;
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects out of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Walks every size class and moves objects from the least used zspages
+ * into free slots of other zspages of that class, returning emptied
+ * zspages to the system. Handles stay valid. May sleep.
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += compact_class(pool, &pool->size_class[i]);
+
+	atomic_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		stats->obj_used += (u64)class->obj_inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+
+	stats->pages_used = atomic_read(&pool->pages_allocated);
+	stats->pages_compacted = atomic_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_stats);
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	zs_handle_cache = kmem_cache_create("zs_handle",
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+	kmem_cache_destroy(zs_handle_cache);
+	return -ENOMEM;
+}
+core_initcall(zs_init);
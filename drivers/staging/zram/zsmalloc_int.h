@@ -0,0 +1,117 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "zsmalloc.h"
+
+/* User configurable params */
+
+/*
+ * A zspage is a group of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order pages,
+ * not necessarily physically contiguous, holding objects of a single
+ * size class. Objects may straddle the boundary between two pages.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes. With 4K
+ * pages this gives 255 classes from 32 bytes up to a full page.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * A zspage is ALMOST_EMPTY when at most (frac - 1) / frac of its
+ * objects are in use. Those are the sources for compaction.
+ */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+/* End of user params */
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+struct zspage;
+
+/*
+ * Handles given out by zs_malloc() point to one of these. The level
+ * of indirection lets compaction move objects without the owner
+ * having to know about it.
+ */
+struct zs_handle {
+	struct zspage *zspage;	/* changed by compaction, under class lock */
+	unsigned int idx;
+	unsigned int class_idx;	/* fixed for the object's lifetime */
+};
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list[] */
+	enum fullness_group fullness;
+	unsigned int inuse;		/* no. of live objects */
+	unsigned int free_hint;		/* where to start looking for a
+					 * free slot */
+	int mapcount;			/* objects currently mapped; such
+					 * zspages are never compacted */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	struct zs_handle *handles[0];	/* back-references, NULL = free */
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size */
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* stats, protected by lock */
+	unsigned long zspages;
+	unsigned long obj_inuse;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	gfp_t flags;			/* allocation flags for zspages */
+	const char *name;
+
+	atomic_t pages_allocated;	/* stats */
+	atomic_t pages_compacted;
+};
+
+/* Per-cpu state between zs_map_object() and zs_unmap_object() */
+struct mapping_area {
+	char *vm_buf;		/* bounce buffer for page-spanning objects */
+	char *vm_addr;		/* address handed to the user */
+	enum zs_mapmode vm_mm;
+	struct zspage *zspage;
+	unsigned long offset;	/* of the object within the zspage */
+	int size;
+	bool bounced;
+};
+
+#endif
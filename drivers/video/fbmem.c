@@ -21,6 +21,7 @@
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/mman.h>
+#include <linux/poll.h>
 #include <linux/vt.h>
 #include <linux/init.h>
 #include <linux/linux_logo.h>
@@ -1397,6 +1398,18 @@ fb_mmap(struct file *file, struct vm_area_struct * vma)
 	return vm_iomap_memory(vma, start, len);
 }
 
+static unsigned int
+fb_poll(struct file *file, poll_table *wait)
+{
+	struct fb_info *info = file_fb_info(file);
+
+	if (!info)
+		return POLLERR;
+	if (!info->fbops->fb_poll)
+		return DEFAULT_POLLMASK;
+	return info->fbops->fb_poll(info, file, wait);
+}
+
 static int
 fb_open(struct inode *inode, struct file *file)
 __acquires(&info->lock)
@@ -1463,6 +1476,7 @@ static const struct file_operations fb_fops = {
 	.compat_ioctl = fb_compat_ioctl,
 #endif
 	.mmap =		fb_mmap,
+	.poll =		fb_poll,
 	.open =		fb_open,
 	.release =	fb_release,
 #ifdef HAVE_ARCH_FB_UNMAPPED_AREA
@@ -30,6 +30,7 @@
 #include <linux/memory.h>
 #include <linux/cpufreq.h>
 #include <linux/kthread.h>
+#include <linux/math64.h>
 #include <plat/clock.h>
 #include <plat/cpu-freq.h>
 #include <plat/media.h>
@@ -125,13 +126,102 @@ static int s3cfb_draw_logo(struct fb_info *fb)
 	return 0;
 }
 #endif
+/*
+ * A gap of more than this many frames between two flips means the screen
+ * was idle rather than that the compositor missed a vsync.
+ */
+#define S3CFB_FLIP_IDLE_VSYNCS	8
+
+/*
+ * Runs from the frame interrupt: only the scanout base is touched here,
+ * fb->var and fb->fix belong to the ioctl side under the fb lock.
+ */
+static void s3cfb_flip_program(struct s3cfb_global *fbdev)
+{
+	if (!fbdev->flip_suspended)
+		s3cfb_set_buffer_address_yoffset(fbdev, fbdev->flip_win,
+						 fbdev->flip_yoffset);
+	fbdev->flip_queued = 0;
+}
+
+/*
+ * The frame interrupt is what latches a queued flip, so keep it on while
+ * one is pending even if userspace turned vsync interrupts off.
+ */
+static void s3cfb_flip_update_irq(struct s3cfb_global *fbdev)
+{
+	int on = fbdev->vsync_user || fbdev->flip_queued ||
+		 fbdev->flip_latched;
+
+	if (on == fbdev->vsync_irq)
+		return;
+
+	if (on)
+		s3cfb_set_global_interrupt(fbdev, 1);
+	s3cfb_set_vsync_interrupt(fbdev, on);
+	fbdev->vsync_irq = on;
+}
+
+static void s3cfb_flip_complete(struct s3cfb_global *fbdev, ktime_t now)
+{
+	u32 gap = fbdev->vsync_count - fbdev->flip_vsync;
+
+	if (fbdev->flip_seq && gap > 1 && gap <= S3CFB_FLIP_IDLE_VSYNCS)
+		fbdev->missed_vsync += gap - 1;
+
+	fbdev->flip_vsync = fbdev->vsync_count;
+	fbdev->flip_timestamp = now;
+	fbdev->flip_seq++;
+	fbdev->flip_latched = 0;
+}
+
+/*
+ * Called at every vsync: the flip programmed at the previous vsync was
+ * latched by the hardware and is now being scanned out, and a queued flip
+ * gets programmed so the hardware latches it at the next one.
+ */
+static void s3cfb_flip_vsync(struct s3cfb_global *fbdev, ktime_t now)
+{
+	s64 delta_us;
+	u32 frames = 1;
+
+	spin_lock(&fbdev->flip_lock);
+
+	/* account for vsyncs whose interrupt was lost */
+	if (fbdev->lcd->freq > 0 && fbdev->vsync_last.tv64) {
+		delta_us = ktime_us_delta(now, fbdev->vsync_last);
+		if (delta_us > 0 && delta_us < USEC_PER_SEC)
+			frames = max_t(u32, 1, div_u64(delta_us *
+				fbdev->lcd->freq + USEC_PER_SEC / 2,
+				USEC_PER_SEC));
+	}
+	fbdev->vsync_count += frames;
+	fbdev->vsync_last = now;
+
+	if (fbdev->flip_latched)
+		s3cfb_flip_complete(fbdev, now);
+
+	if (fbdev->flip_queued) {
+		s3cfb_flip_program(fbdev);
+		fbdev->flip_latched = 1;
+	}
+
+	s3cfb_flip_update_irq(fbdev);
+
+	spin_unlock(&fbdev->flip_lock);
+}
+
 static irqreturn_t s3cfb_irq_frame(int irq, void *data)
 {
 	struct s3cfb_global *fbdev = (struct s3cfb_global *)data;
+	ktime_t now;
 
 	s3cfb_clear_interrupt(fbdev);
 
-	fbdev->vsync_timestamp = ktime_get();
+	now = ktime_get();
+	s3cfb_flip_vsync(fbdev, now);
+
+	fbdev->vsync_timestamp = now;
 	wmb();
 	wake_up_interruptible(&fbdev->vsync_wait);
 
@@ -161,6 +251,7 @@ static int s3cfb_init_global(struct s3cfb_global *ctrl)
 	ctrl->rgb_mode = MODE_RGB_P;
 
 	init_waitqueue_head(&ctrl->vsync_wait);
+	spin_lock_init(&ctrl->flip_lock);
 	mutex_init(&ctrl->lock);
 
 	s3cfb_set_output(ctrl);
@@ -601,6 +692,82 @@ static int s3cfb_wait_for_vsync(struct s3cfb_global *ctrl)
 
 	return ret;
 }
+/* called from the ioctl, with the fb lock held */
+static int s3cfb_queue_flip(struct s3cfb_global *fbdev, struct fb_info *fb,
+			    u32 yoffset)
+{
+	struct s3cfb_window *win = fb->par;
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+
+	if (fbdev->flip_queued) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (win->owner == DMA_MEM_OTHER)
+		fb->fix.smem_start = win->other_mem_addr;
+	fb->var.yoffset = yoffset;
+
+	fbdev->flip_win = win->id;
+	fbdev->flip_yoffset = yoffset;
+	fbdev->flip_queued = 1;
+
+	/* nothing is scanned out while suspended, complete right away */
+	if (fbdev->flip_suspended) {
+		s3cfb_flip_program(fbdev);
+		s3cfb_flip_complete(fbdev, ktime_get());
+		wake_up_interruptible(&fbdev->vsync_wait);
+	}
+
+	s3cfb_flip_update_irq(fbdev);
+
+out:
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	return ret;
+}
+
+static void s3cfb_get_flip_status(struct s3cfb_global *fbdev,
+				  struct s3cfb_flip_status *status)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	status->timestamp = ktime_to_ns(fbdev->flip_timestamp);
+	status->seq = fbdev->flip_seq;
+	status->vsync_count = fbdev->vsync_count;
+	status->missed_vsync = fbdev->missed_vsync;
+	status->pending = fbdev->flip_queued + fbdev->flip_latched;
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+}
+
+/*
+ * POLLIN: every queued flip is on screen, S3CFB_GET_FLIP_STATUS has its
+ * vsync timestamp. POLLOUT: another flip can be queued.
+ */
+static unsigned int s3cfb_poll(struct fb_info *fb, struct file *file,
+			       struct poll_table_struct *wait)
+{
+	struct s3cfb_global *fbdev =
+		platform_get_drvdata(to_platform_device(fb->device));
+	unsigned int mask = 0;
+	unsigned long flags;
+
+	poll_wait(file, &fbdev->vsync_wait, wait);
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	if (!fbdev->flip_queued && !fbdev->flip_latched)
+		mask |= POLLIN | POLLRDNORM;
+	if (!fbdev->flip_queued)
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	return mask;
+}
+
 static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 {
 	struct s3cfb_global *fbdev =
@@ -617,7 +784,9 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 		struct s3cfb_user_window user_window;
 		struct s3cfb_user_plane_alpha user_alpha;
 		struct s3cfb_user_chroma user_chroma;
+		struct s3cfb_flip_status flip_status;
 		int vsync;
+		u32 yoffset;
 	} p;
 
 	switch (cmd) {
@@ -634,6 +803,23 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 		}
 		break;
 
+	case S3CFB_FLIP_ASYNC:
+		if (get_user(p.yoffset, (u32 __user *)arg))
+			ret = -EFAULT;
+		else if (var->yres > var->yres_virtual ||
+			 p.yoffset > var->yres_virtual - var->yres)
+			ret = -EINVAL;
+		else
+			ret = s3cfb_queue_flip(fbdev, fb, p.yoffset);
+		break;
+
+	case S3CFB_GET_FLIP_STATUS:
+		s3cfb_get_flip_status(fbdev, &p.flip_status);
+		if (copy_to_user((struct s3cfb_flip_status __user *)arg,
+				 &p.flip_status, sizeof(p.flip_status)))
+			ret = -EFAULT;
+		break;
+
 	case S3CFB_WIN_POSITION:
 		if (copy_from_user(&p.user_window,
 				   (struct s3cfb_user_window __user *)arg,
@@ -695,10 +881,12 @@ static int s3cfb_ioctl(struct fb_info *fb, unsigned int cmd, unsigned long arg)
 		if (get_user(p.vsync, (int __user *)arg))
 			ret = -EFAULT;
 		else {
-			if (p.vsync)
-				s3cfb_set_global_interrupt(fbdev, 1);
+			unsigned long flags;
 
-			s3cfb_set_vsync_interrupt(fbdev, p.vsync);
+			spin_lock_irqsave(&fbdev->flip_lock, flags);
+			fbdev->vsync_user = !!p.vsync;
+			s3cfb_flip_update_irq(fbdev);
+			spin_unlock_irqrestore(&fbdev->flip_lock, flags);
 		}
 		break;
 
@@ -734,6 +922,7 @@ struct fb_ops s3cfb_ops = {
 	.fb_pan_display = s3cfb_pan_display,
 	.fb_setcolreg = s3cfb_setcolreg,
 	.fb_ioctl = s3cfb_ioctl,
+	.fb_poll = s3cfb_poll,
 	.fb_open = s3cfb_open,
 	.fb_release = s3cfb_release,
 };
@@ -1038,6 +1227,8 @@ static int __devinit s3cfb_probe(struct platform_device *pdev)
 
 	s3cfb_set_vsync_interrupt(fbdev, 1);
 	s3cfb_set_global_interrupt(fbdev, 1);
+	fbdev->vsync_user = 1;
+	fbdev->vsync_irq = 1;
 
 #ifdef CONFIG_FB_S3C_MDNIE
 	s3c_mdnie_setup();
@@ -1189,12 +1380,40 @@ static int __devexit s3cfb_remove(struct platform_device *pdev)
 	return 0;
 }
 
+/*
+ * Flips pending when the display goes off will never see a vsync: finish
+ * them now and complete later ones immediately until resume.
+ */
+static void s3cfb_flip_suspend(struct s3cfb_global *fbdev, int suspend)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&fbdev->flip_lock, flags);
+	if (suspend) {
+		if (fbdev->flip_queued || fbdev->flip_latched) {
+			if (fbdev->flip_queued)
+				s3cfb_flip_program(fbdev);
+			s3cfb_flip_complete(fbdev, ktime_get());
+		}
+	}
+	fbdev->flip_suspended = suspend;
+	/* no vsyncs were lost while the display was off */
+	fbdev->vsync_last = ktime_set(0, 0);
+	if (!suspend)
+		s3cfb_flip_update_irq(fbdev);
+	spin_unlock_irqrestore(&fbdev->flip_lock, flags);
+
+	wake_up_interruptible(&fbdev->vsync_wait);
+}
+
 void s3cfb_early_suspend(struct early_suspend *h)
 {
 	struct s3cfb_global *fbdev =
 		container_of(h, struct s3cfb_global, early_suspend);
 
 	pr_debug("s3cfb_early_suspend is called\n");
+
+	s3cfb_flip_suspend(fbdev, 1);
 #ifdef CONFIG_FB_S3C_MDNIE
 	writel(0,fbdev->regs + 0x27c);
 	msleep(20);
@@ -1276,6 +1495,9 @@ void s3cfb_late_resume(struct early_suspend *h)
 
 	s3cfb_set_vsync_interrupt(fbdev, 1);
 	s3cfb_set_global_interrupt(fbdev, 1);
+	fbdev->vsync_irq = 1;
+
+	s3cfb_flip_suspend(fbdev, 0);
 
 	if (pdata->backlight_on)
 		pdata->backlight_on(pdev);
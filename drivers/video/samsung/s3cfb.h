@@ -235,6 +235,22 @@ struct s3cfb_global {
 	wait_queue_head_t	vsync_wait;
 	ktime_t			vsync_timestamp;
 
+	/* asynchronous flips, see S3CFB_FLIP_ASYNC */
+	spinlock_t		flip_lock;
+	int			flip_win;
+	int			flip_queued;
+	u32			flip_yoffset;
+	int			flip_latched;
+	u32			flip_seq;
+	ktime_t			flip_timestamp;
+	u32			vsync_count;
+	ktime_t			vsync_last;	/* to count lost vsyncs */
+	u32			flip_vsync;
+	u32			missed_vsync;
+	int			flip_suspended;
+	int			vsync_user;	/* S3CFB_SET_VSYNC_INT setting */
+	int			vsync_irq;	/* frame interrupt enabled */
+
 	/* fimd */
 	int			enabled;
 	int			dsi;
@@ -280,6 +296,22 @@ struct s3cfb_user_chroma {
 	unsigned char	blue;
 };
 
+/*
+ * struct s3cfb_flip_status
+ * @timestamp:		vsync time (ns) at which the last flip hit the screen
+ * @seq:		number of flips that reached the screen
+ * @vsync_count:	vsyncs seen, including ones whose irq was lost
+ * @missed_vsync:	vsyncs that repeated a frame while flipping
+ * @pending:		flips queued or programmed but not on screen yet
+*/
+struct s3cfb_flip_status {
+	__u64		timestamp;
+	__u32		seq;
+	__u32		vsync_count;
+	__u32		missed_vsync;
+	__u32		pending;
+};
+
 struct s3cfb_next_info {
 	unsigned int phy_start_addr;
 	unsigned int xres;		/* visible resolution*/
@@ -317,6 +349,14 @@ struct s3cfb_next_info {
 						enum s3cfb_mem_owner_t)
 // New IOCTL that waits for vsync and returns a timestamp
 #define S3CFB_WAIT_FOR_VSYNC  _IOR('F', 311, u64)
+/*
+ * Queue a pan to the given yoffset without waiting; it is programmed at
+ * the next vsync and completes (poll POLLIN) when it is being scanned out.
+ * One flip may be queued behind the one on its way to the screen.
+ */
+#define S3CFB_FLIP_ASYNC		_IOW('F', 312, u32)
+#define S3CFB_GET_FLIP_STATUS		_IOR('F', 313, \
+						struct s3cfb_flip_status)
 
 /*
  * E X T E R N S
@@ -352,6 +392,8 @@ extern int s3cfb_set_alpha_blending(struct s3cfb_global *ctrl, int id);
 extern int s3cfb_set_window_position(struct s3cfb_global *ctrl, int id);
 extern int s3cfb_set_window_size(struct s3cfb_global *ctrl, int id);
 extern int s3cfb_set_buffer_address(struct s3cfb_global *ctrl, int id);
+extern int s3cfb_set_buffer_address_yoffset(struct s3cfb_global *ctrl, int id,
+					    u32 yoffset);
 extern int s3cfb_set_buffer_size(struct s3cfb_global *ctrl, int id);
 extern int s3cfb_set_chroma_key(struct s3cfb_global *ctrl, int id);
 
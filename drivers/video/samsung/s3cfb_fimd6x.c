@@ -577,7 +577,8 @@ int s3cfb_set_window_control(struct s3cfb_global *ctrl, int id)
 	return 0;
 }
 
-int s3cfb_set_buffer_address(struct s3cfb_global *ctrl, int id)
+int s3cfb_set_buffer_address_yoffset(struct s3cfb_global *ctrl, int id,
+				     u32 yoffset)
 {
 	struct fb_fix_screeninfo *fix = &ctrl->fb[id]->fix;
 	struct fb_var_screeninfo *var = &ctrl->fb[id]->var;
@@ -587,7 +588,7 @@ int s3cfb_set_buffer_address(struct s3cfb_global *ctrl, int id)
 
 	if (fix->smem_start) {
 		start_addr = fix->smem_start + (var->xres_virtual *
-				(var->bits_per_pixel / 8) * var->yoffset);
+				(var->bits_per_pixel / 8) * yoffset);
 
 		end_addr = start_addr + fix->line_length * var->yres;
 	}
@@ -613,6 +614,12 @@ int s3cfb_set_buffer_address(struct s3cfb_global *ctrl, int id)
 	return 0;
 }
 
+int s3cfb_set_buffer_address(struct s3cfb_global *ctrl, int id)
+{
+	return s3cfb_set_buffer_address_yoffset(ctrl, id,
+						ctrl->fb[id]->var.yoffset);
+}
+
 int s3cfb_set_alpha_value_width(struct s3cfb_global *ctrl, int id)
 {
        struct fb_info *fb = ctrl->fb[id];
@@ -961,6 +961,7 @@ static int de_thread(struct task_struct *tsk)
 
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
+		lmk_adj_replace(leader, tsk);
 
 		tsk->exit_signal = SIGCHLD;
 
@@ -1094,6 +1094,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lmk_adj_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1229,6 +1230,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lmk_adj_update(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
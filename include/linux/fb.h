@@ -413,6 +413,7 @@ struct vm_area_struct;
 struct fb_info;
 struct device;
 struct file;
+struct poll_table_struct;
 
 /* Definitions below are used in the parsed monitor specs */
 #define FB_DPMS_ACTIVE_OFF	1
@@ -681,6 +682,10 @@ struct fb_ops {
 	/* perform fb specific mmap */
 	int (*fb_mmap)(struct fb_info *info, struct vm_area_struct *vma);
 
+	/* poll for driver specific events, e.g. flip completion (optional) */
+	unsigned int (*fb_poll)(struct fb_info *info, struct file *file,
+				struct poll_table_struct *wait);
+
 	/* get capability given var */
 	void (*fb_get_caps)(struct fb_info *info, struct fb_blit_caps *caps,
 			    struct fb_var_screeninfo *var);
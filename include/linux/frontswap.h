@@ -0,0 +1,109 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+
+/*
+ * A frontswap backend is handed swap pages before they are submitted
+ * to the swap device. A page it accepts with put_page must be returned
+ * by get_page until flush_page or flush_area is called for it, so,
+ * unlike cleancache, frontswap is a "persistent" store.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned);
+	int (*put_page)(unsigned, pgoff_t, struct page *);
+	int (*get_page)(unsigned, pgoff_t, struct page *);
+	void (*flush_page)(unsigned, pgoff_t);
+	void (*flush_area)(unsigned);
+};
+
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+extern void __frontswap_init(struct swap_info_struct *);
+extern int __frontswap_put_page(struct page *);
+extern int __frontswap_get_page(struct page *);
+extern void __frontswap_flush_page(struct swap_info_struct *, pgoff_t);
+extern void __frontswap_flush_area(struct swap_info_struct *);
+extern int frontswap_enabled;
+
+#ifdef CONFIG_FRONTSWAP
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return sis->frontswap_map && test_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_set(struct swap_info_struct *sis, pgoff_t offset)
+{
+	set_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_clear(struct swap_info_struct *sis,
+				pgoff_t offset)
+{
+	clear_bit(offset, sis->frontswap_map);
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return sis->frontswap_map;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				unsigned long *map)
+{
+	sis->frontswap_map = map;
+}
+#else
+#define frontswap_enabled (0)
+#define frontswap_test(_sis, _offset) (0)
+#define frontswap_map_get(_sis) (NULL)
+#define frontswap_map_set(_sis, _map) do { } while (0)
+#endif
+
+/*
+ * As with cleancache, these hooks compile away without CONFIG_FRONTSWAP
+ * and reduce to a single global variable check until a backend has
+ * registered. The swap device is not touched for pages a backend
+ * accepts: the bio for them is never built.
+ */
+
+static inline void frontswap_init(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled)
+		__frontswap_init(sis);
+}
+
+static inline int frontswap_put_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_put_page(page);
+	return ret;
+}
+
+static inline int frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_get_page(page);
+	return ret;
+}
+
+static inline void frontswap_flush_page(struct swap_info_struct *sis,
+				pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_page(sis, offset);
+}
+
+static inline void frontswap_flush_area(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_area(sis);
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
@@ -304,6 +304,25 @@ struct ion_custom_data {
 	unsigned long arg;
 };
 
+/**
+ * struct ion_sync_range_data - a range of a cached buffer to sync
+ * @fd:		a file descriptor obtained from ION_IOC_SHARE or ION_IOC_MAP
+ * @flags:	ION_SYNC_CLEAN, ION_SYNC_INVALIDATE or both
+ * @offset:	start of the range, in bytes
+ * @len:	length of the range in bytes, 0 for the rest of the buffer
+ */
+struct ion_sync_range_data {
+	int fd;
+	unsigned int flags;
+	size_t offset;
+	size_t len;
+};
+
+#define ION_SYNC_CLEAN		1	/* write back cpu writes before the
+					   device reads the buffer */
+#define ION_SYNC_INVALIDATE	2	/* discard stale cache lines after the
+					   device wrote the buffer */
+
 #define ION_IOC_MAGIC		'I'
 
 /**
@@ -362,6 +381,17 @@ struct ion_custom_data {
  */
 #define ION_IOC_SYNC		_IOWR(ION_IOC_MAGIC, 7, struct ion_fd_data)
 
+/**
+ * DOC: ION_IOC_SYNC_RANGE - clean and/or invalidate part of a cached buffer
+ *
+ * Takes an ion_sync_range_data struct.  For buffers whose user mappings
+ * are faulted in (ION_FLAG_CACHED without ION_FLAG_CACHED_NEEDS_SYNC), a
+ * clean only writes back the pages the cpu has touched since they were
+ * last synced for a device.
+ */
+#define ION_IOC_SYNC_RANGE	_IOWR(ION_IOC_MAGIC, 8, \
+				      struct ion_sync_range_data)
+
 /**
  * DOC: ION_IOC_CUSTOM - call architecture specific ion ioctl
  *
@@ -0,0 +1,37 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  A byte-oriented LZ77 compressor producing the LZ4 block format.
+ *  Compression is a single greedy pass over a hash table; decompression
+ *  needs no working memory and is mostly plain copies, which makes it
+ *  considerably faster than LZO1X on in-order cores.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	(sizeof(u32) << LZ4_HASH_LOG)
+
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS. It need not be
+ * initialized and is meant to be reused from one call to the next.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/* safe decompression with overrun testing */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK			0
+#define LZ4_E_ERROR			(-1)
+#define LZ4_E_INPUT_OVERRUN		(-4)
+#define LZ4_E_OUTPUT_OVERRUN		(-5)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-6)
+
+#endif
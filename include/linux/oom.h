@@ -70,6 +70,33 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * The Android low memory killer keeps thread group leaders bucketed by
+ * oom_score_adj, so that it can pick a victim without walking every
+ * process.  These keep the buckets in sync with fork, exec, exit and
+ * oom_score_adj changes.
+ */
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+extern void lmk_adj_add(struct task_struct *p);
+extern void lmk_adj_remove(struct task_struct *p);
+extern void lmk_adj_replace(struct task_struct *old, struct task_struct *new);
+extern void lmk_adj_update(struct task_struct *p);
+#else
+static inline void lmk_adj_add(struct task_struct *p)
+{
+}
+static inline void lmk_adj_remove(struct task_struct *p)
+{
+}
+static inline void lmk_adj_replace(struct task_struct *old,
+				   struct task_struct *new)
+{
+}
+static inline void lmk_adj_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
@@ -1283,6 +1283,11 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LMK_ADJ_BUCKETS
+	/* thread group leaders only, see lmk_adj_add() */
+	struct hlist_node lmk_adj_node;
+	int lmk_adj;		/* oom_score_adj of the bucket we are in */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
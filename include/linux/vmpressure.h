@@ -0,0 +1,32 @@
+#ifndef _LINUX_VMPRESSURE_H
+#define _LINUX_VMPRESSURE_H
+
+#include <linux/types.h>
+#include <linux/gfp.h>
+#include <linux/notifier.h>
+
+/*
+ * Memory pressure as seen by page reclaim: the share of scanned pages
+ * that could not be reclaimed, sampled over a window of scanned pages.
+ */
+enum vmpressure_level {
+	VMPRESSURE_LOW = 0,
+	VMPRESSURE_MEDIUM,
+	VMPRESSURE_CRITICAL,
+	VMPRESSURE_NUM_LEVELS,
+};
+
+#ifdef CONFIG_VMPRESSURE
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern int vmpressure_register_notifier(struct notifier_block *nb);
+extern int vmpressure_unregister_notifier(struct notifier_block *nb);
+extern const char *vmpressure_level_name(enum vmpressure_level level);
+#else
+static inline void vmpressure(gfp_t gfp, unsigned long scanned,
+			      unsigned long reclaimed)
+{
+}
+#endif
+
+#endif /* _LINUX_VMPRESSURE_H */
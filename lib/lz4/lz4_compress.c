@@ -0,0 +1,158 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Greedy single pass compressor producing the LZ4 block format.
+ *  Matches are found through a hash table of the positions where each
+ *  4-byte sequence was last seen; no chains are kept.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline u32 lz4_read32(const unsigned char *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+/* Emit the extension bytes of a run or match length */
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len, void *wrkmem)
+{
+	u32 *hash_table = wrkmem;
+	const unsigned char *ip = in;
+	const unsigned char *anchor = in;
+	const unsigned char * const in_end = in + in_len;
+	const unsigned char * const mflimit = in_end - LZ4_MFLIMIT;
+	const unsigned char * const matchlimit = in_end - LZ4_LAST_LITERALS;
+	unsigned char *op = out;
+	unsigned char * const op_end = out + *out_len;
+	unsigned char *token;
+	size_t run;
+
+	/*
+	 * The table is not cleared: entries left by an earlier call (or
+	 * never written) are offsets that are either not behind ip, and
+	 * rejected, or point inside this input, where the sequence is
+	 * compared before use. That saves a 16KB memset per page.
+	 */
+	if (in_len < LZ4_MFLIMIT + 1)
+		goto last_literals;
+
+	while (ip < mflimit) {
+		const unsigned char *ref, *match_start;
+		u32 seq = lz4_read32(ip);
+		u32 h = lz4_hash(seq);
+		u32 ref_pos = hash_table[h];
+		size_t match_len;
+		u16 offset;
+
+		hash_table[h] = ip - in;
+
+		if (ref_pos >= (u32)(ip - in) ||
+				ip - in - ref_pos > LZ4_MAX_DISTANCE ||
+				lz4_read32(in + ref_pos) != seq) {
+			ip++;
+			continue;
+		}
+		ref = in + ref_pos;
+
+		/* Extend the match backwards into pending literals */
+		while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		offset = ip - ref;
+		run = ip - anchor;
+		match_start = ip;
+
+		ip += LZ4_MIN_MATCH;
+		ref += LZ4_MIN_MATCH;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+		match_len = ip - match_start - LZ4_MIN_MATCH;
+
+		/*
+		 * Worst case for this sequence, plus room for the
+		 * trailing literals-only sequence.
+		 */
+		if ((size_t)(op_end - op) < 1 + run / 255 + 1 + run + 2 +
+				match_len / 255 + 1 + 1 + LZ4_LAST_LITERALS)
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		token = op++;
+		if (run >= LZ4_RUN_MASK) {
+			*token = LZ4_RUN_MASK << LZ4_ML_BITS;
+			op = lz4_put_length(op, run - LZ4_RUN_MASK);
+		} else {
+			*token = run << LZ4_ML_BITS;
+		}
+
+		memcpy(op, anchor, run);
+		op += run;
+
+		put_unaligned_le16(offset, op);
+		op += 2;
+
+		if (match_len >= LZ4_ML_MASK) {
+			*token |= LZ4_ML_MASK;
+			op = lz4_put_length(op, match_len - LZ4_ML_MASK);
+		} else {
+			*token |= match_len;
+		}
+
+		anchor = ip;
+
+		/* Seed the table with a position inside the match */
+		if (ip < mflimit)
+			hash_table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - in;
+	}
+
+last_literals:
+	run = in_end - anchor;
+	if ((size_t)(op_end - op) < 1 + run / 255 + 1 + run)
+		return LZ4_E_OUTPUT_OVERRUN;
+
+	token = op++;
+	if (run >= LZ4_RUN_MASK) {
+		*token = LZ4_RUN_MASK << LZ4_ML_BITS;
+		op = lz4_put_length(op, run - LZ4_RUN_MASK);
+	} else {
+		*token = run << LZ4_ML_BITS;
+	}
+	memcpy(op, anchor, run);
+	op += run;
+
+	*out_len = op - out;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
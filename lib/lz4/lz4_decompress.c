@@ -0,0 +1,140 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Safe decoder for the LZ4 block format: every length and offset read
+ *  from the input is checked against the input and output bounds, so
+ *  corrupted data cannot make it read or write out of range.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/*
+ * Read the extension bytes of a run or match length. Returns -1 if
+ * the input ends in the middle of the length.
+ */
+static inline int lz4_get_length(const unsigned char **ipp,
+				const unsigned char *ip_end, size_t *len)
+{
+	const unsigned char *ip = *ipp;
+	unsigned char s;
+
+	do {
+		if (ip >= ip_end)
+			return -1;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return 0;
+}
+
+int lz4_decompress_safe(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len)
+{
+	const unsigned char *ip = in;
+	const unsigned char * const ip_end = in + in_len;
+	unsigned char *op = out;
+	unsigned char * const op_end = out + *out_len;
+
+	*out_len = 0;
+
+	while (ip < ip_end) {
+		const unsigned char *ref;
+		unsigned int token;
+		size_t len, offset;
+
+		token = *ip++;
+
+		/* literals */
+		len = token >> LZ4_ML_BITS;
+		if (len == LZ4_RUN_MASK &&
+				lz4_get_length(&ip, ip_end, &len))
+			goto input_overrun;
+		if (len > (size_t)(ip_end - ip))
+			goto input_overrun;
+		if (len > (size_t)(op_end - op))
+			goto output_overrun;
+
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence has no match part */
+		if (ip == ip_end)
+			break;
+
+		/* match */
+		if (ip_end - ip < 2)
+			goto input_overrun;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - out))
+			goto lookbehind_overrun;
+		ref = op - offset;
+
+		len = token & LZ4_ML_MASK;
+		if (len == LZ4_ML_MASK &&
+				lz4_get_length(&ip, ip_end, &len))
+			goto input_overrun;
+		len += LZ4_MIN_MATCH;
+		if (len > (size_t)(op_end - op))
+			goto output_overrun;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else if (offset >= 8) {
+			/*
+			 * Overlapping match, but 8 byte chunks never
+			 * overlap their own source.
+			 */
+			while (len >= 8) {
+				memcpy(op, ref, 8);
+				op += 8;
+				ref += 8;
+				len -= 8;
+			}
+			while (len--)
+				*op++ = *ref++;
+		} else {
+			/* short period repeat, e.g. a run of one byte */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*out_len = op - out;
+	return LZ4_E_OK;
+
+input_overrun:
+	*out_len = op - out;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*out_len = op - out;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*out_len = op - out;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ *  lz4defs.h -- LZ4 block format constants
+ *
+ *  Each sequence is a token byte (literal length in the high nibble,
+ *  match length - LZ4_MIN_MATCH in the low nibble), optional length
+ *  extension bytes, the literals, a 16-bit little endian match offset
+ *  and optional match length extension bytes. The block ends with a
+ *  sequence made of literals only.
+ */
+
+#define LZ4_MIN_MATCH		4
+#define LZ4_LAST_LITERALS	5	/* block always ends with literals */
+#define LZ4_MFLIMIT		12	/* no match may start after this */
+#define LZ4_MAX_DISTANCE	65535
+
+#define LZ4_ML_BITS		4
+#define LZ4_ML_MASK		((1U << LZ4_ML_BITS) - 1)
+#define LZ4_RUN_BITS		(8 - LZ4_ML_BITS)
+#define LZ4_RUN_MASK		((1U << LZ4_RUN_BITS) - 1)
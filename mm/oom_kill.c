@@ -61,6 +61,7 @@ int test_set_oom_score_adj(int new_val)
 		current->signal->oom_score_adj = new_val;
 	}
 	spin_unlock_irq(&sighand->siglock);
+	lmk_adj_update(current);
 
 	return old_val;
 }
@@ -0,0 +1,125 @@
+/*
+ * Reclaim efficiency based memory pressure levels
+ *
+ * Page reclaim reports how many pages it scanned and how many of those
+ * it managed to free. Once a window's worth of pages has been scanned
+ * the ratio is turned into a pressure level and handed to the
+ * registered notifiers from process context.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Scanned pages per sample: small enough to react within a few reclaim
+ * passes, large enough that one unlucky SWAP_CLUSTER_MAX batch does not
+ * raise an event on its own.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+/* Percentage of scanned pages left unreclaimed */
+static const unsigned int vmpressure_level_med = 60;
+static const unsigned int vmpressure_level_critical = 95;
+
+static DEFINE_SPINLOCK(vmpressure_lock);
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static enum vmpressure_level vmpressure_pending;
+
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notifier);
+
+static const char * const vmpressure_str_levels[] = {
+	[VMPRESSURE_LOW] = "low",
+	[VMPRESSURE_MEDIUM] = "medium",
+	[VMPRESSURE_CRITICAL] = "critical",
+};
+
+const char *vmpressure_level_name(enum vmpressure_level level)
+{
+	return vmpressure_str_levels[level];
+}
+EXPORT_SYMBOL(vmpressure_level_name);
+
+static enum vmpressure_level vmpressure_calc_level(unsigned long scanned,
+						   unsigned long reclaimed)
+{
+	unsigned long pressure;
+
+	/* reclaim may free more than it scanned, e.g. on THP splits */
+	if (reclaimed >= scanned)
+		return VMPRESSURE_LOW;
+
+	pressure = (scanned - reclaimed) * 100 / scanned;
+	if (pressure >= vmpressure_level_critical)
+		return VMPRESSURE_CRITICAL;
+	if (pressure >= vmpressure_level_med)
+		return VMPRESSURE_MEDIUM;
+	return VMPRESSURE_LOW;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	enum vmpressure_level level;
+
+	spin_lock(&vmpressure_lock);
+	level = vmpressure_pending;
+	spin_unlock(&vmpressure_lock);
+
+	blocking_notifier_call_chain(&vmpressure_notifier, level, NULL);
+}
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+/*
+ * Called from shrink_zone() for global reclaim, from both kswapd and
+ * direct reclaim. Should be cheap: the notifiers run from a work item.
+ */
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	enum vmpressure_level level;
+
+	/*
+	 * Only allocations that can be served from the LRUs say anything
+	 * about how easy reclaimable memory is to come by.
+	 */
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	if (vmpressure_scanned < vmpressure_win) {
+		spin_unlock(&vmpressure_lock);
+		return;
+	}
+	level = vmpressure_calc_level(vmpressure_scanned,
+				      vmpressure_reclaimed);
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	/* if the work has not run yet, report the worst level seen */
+	if (!work_pending(&vmpressure_work) || level > vmpressure_pending)
+		vmpressure_pending = level;
+	spin_unlock(&vmpressure_lock);
+
+	schedule_work(&vmpressure_work);
+}
+
+int vmpressure_register_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_register_notifier);
+
+int vmpressure_unregister_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL(vmpressure_unregister_notifier);
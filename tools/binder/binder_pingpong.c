@@ -0,0 +1,342 @@
+/*
+ * binder_pingpong - binder transaction round trip latency
+ *
+ * Forks a server that registers as the binder context manager and
+ * answers every transaction with a reply of the same size, then times
+ * synchronous transactions to it from the parent.
+ *
+ * Only one context manager may exist at a time, and it must keep the uid
+ * of the first one, so run this with servicemanager stopped and as its
+ * uid, e.g. "stop; stop servicemanager" from a root shell and then
+ * "su system -c binder_pingpong".
+ *
+ * Usage: binder_pingpong [-n iterations] [-s payload bytes]
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define BINDER_MAP_SIZE		(128 * 1024)
+#define MAX_PAYLOAD		(64 * 1024)
+
+/* transaction codes */
+#define PINGPONG_PING		1
+#define PINGPONG_QUIT		2
+
+struct binder_state {
+	int fd;
+	void *map;
+};
+
+static int binder_open(struct binder_state *bs)
+{
+	struct binder_version vers;
+
+	bs->fd = open(BINDER_DEV, O_RDWR);
+	if (bs->fd < 0) {
+		perror("open " BINDER_DEV);
+		return -1;
+	}
+	if (ioctl(bs->fd, BINDER_VERSION, &vers) < 0 ||
+	    vers.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		return -1;
+	}
+	bs->map = mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE,
+		       bs->fd, 0);
+	if (bs->map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	return 0;
+}
+
+static int binder_write_read(struct binder_state *bs,
+			     void *wbuf, size_t wlen,
+			     void *rbuf, size_t rlen, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wlen;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rlen;
+
+	while (ioctl(bs->fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR) {
+			perror("BINDER_WRITE_READ");
+			return -1;
+		}
+		/* do not resend what was already consumed */
+		bwr.write_buffer += bwr.write_consumed;
+		bwr.write_size -= bwr.write_consumed;
+		bwr.write_consumed = 0;
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Append "cmd [tr]" to a command buffer; used both for transactions and
+ * for the BC_FREE_BUFFER that has to follow every buffer we are handed.
+ */
+static size_t put_cmd(uint8_t *p, uint32_t cmd, const void *arg, size_t len)
+{
+	memcpy(p, &cmd, sizeof(cmd));
+	memcpy(p + sizeof(cmd), arg, len);
+	return sizeof(cmd) + len;
+}
+
+static void fill_tr(struct binder_transaction_data *tr, uint32_t code,
+		    const void *data, size_t size)
+{
+	memset(tr, 0, sizeof(*tr));
+	tr->target.handle = 0;
+	tr->code = code;
+	tr->data_size = size;
+	tr->data.ptr.buffer = data;
+}
+
+/*
+ * Walk the returned commands, copying out the first BR_TRANSACTION or
+ * BR_REPLY. Returns that command, 0 if there was none, or -1 on error.
+ */
+static int parse_read(uint8_t *p, size_t len,
+		      struct binder_transaction_data *tr)
+{
+	uint8_t *end = p + len;
+	int found = 0;
+
+	while (p < end) {
+		uint32_t cmd;
+
+		memcpy(&cmd, p, sizeof(cmd));
+		p += sizeof(cmd);
+		switch (cmd) {
+		case BR_TRANSACTION:
+		case BR_REPLY:
+			if (!found) {
+				memcpy(tr, p, sizeof(*tr));
+				found = cmd;
+			}
+			break;
+		case BR_DEAD_REPLY:
+		case BR_FAILED_REPLY:
+			fprintf(stderr, "transaction failed (%s)\n",
+				cmd == BR_DEAD_REPLY ? "dead" : "failed");
+			return -1;
+		default:
+			break;
+		}
+		p += _IOC_SIZE(cmd);
+	}
+	return found;
+}
+
+static int server(int ready_fd, size_t max_size)
+{
+	struct binder_state bs;
+	struct binder_transaction_data tr, reply;
+	uint8_t rbuf[256], wbuf[128];
+	char *payload;
+	size_t wlen, rlen;
+	uint32_t cmd;
+	int quit = 0;
+
+	payload = calloc(1, max_size ? max_size : 1);
+	if (!payload || binder_open(&bs) < 0)
+		return 1;
+	if (ioctl(bs.fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR");
+		return 1;
+	}
+	cmd = BC_ENTER_LOOPER;
+	if (binder_write_read(&bs, &cmd, sizeof(cmd), NULL, 0, NULL) < 0)
+		return 1;
+	if (write(ready_fd, "", 1) != 1)
+		return 1;
+	close(ready_fd);
+
+	wlen = 0;
+	while (!quit) {
+		int ret;
+
+		if (binder_write_read(&bs, wbuf, wlen, rbuf, sizeof(rbuf),
+				      &rlen) < 0)
+			return 1;
+		wlen = 0;
+		ret = parse_read(rbuf, rlen, &tr);
+		if (ret < 0)
+			return 1;
+		if (ret != (int)BR_TRANSACTION)
+			continue;
+
+		quit = tr.code == PINGPONG_QUIT;
+		fill_tr(&reply, 0, payload,
+			tr.data_size < max_size ? tr.data_size : max_size);
+		wlen += put_cmd(wbuf + wlen, BC_FREE_BUFFER,
+				&tr.data.ptr.buffer, sizeof(void *));
+		wlen += put_cmd(wbuf + wlen, BC_REPLY, &reply, sizeof(reply));
+	}
+	/* send the last reply */
+	binder_write_read(&bs, wbuf, wlen, NULL, 0, NULL);
+	return 0;
+}
+
+/* Send one transaction and wait for its reply; returns 0 on success. */
+static int transact(struct binder_state *bs, uint32_t code,
+		    const void *data, size_t size, const void **reply_buf)
+{
+	struct binder_transaction_data tr;
+	uint8_t rbuf[256], wbuf[128];
+	size_t wlen = 0, rlen;
+	int ret;
+
+	/* free the previous reply in the same ioctl */
+	if (*reply_buf)
+		wlen += put_cmd(wbuf + wlen, BC_FREE_BUFFER, reply_buf,
+				sizeof(void *));
+	*reply_buf = NULL;
+	fill_tr(&tr, code, data, size);
+	wlen += put_cmd(wbuf + wlen, BC_TRANSACTION, &tr, sizeof(tr));
+
+	do {
+		if (binder_write_read(bs, wbuf, wlen, rbuf, sizeof(rbuf),
+				      &rlen) < 0)
+			return -1;
+		wlen = 0;
+		ret = parse_read(rbuf, rlen, &tr);
+		if (ret < 0)
+			return -1;
+	} while (ret != (int)BR_REPLY);
+
+	*reply_buf = tr.data.ptr.buffer;
+	return 0;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-s payload bytes]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct binder_state bs;
+	const void *reply_buf = NULL;
+	unsigned long iters = 10000, i;
+	size_t size = 0;
+	uint64_t *lat, total = 0;
+	char *payload;
+	int pipefd[2], status, opt;
+	char c;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!iters || size > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	if (pipe(pipefd) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		close(pipefd[0]);
+		_exit(server(pipefd[1], size));
+	}
+	close(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		waitpid(pid, &status, 0);
+		return 1;
+	}
+
+	lat = calloc(iters, sizeof(*lat));
+	payload = calloc(1, size ? size : 1);
+	if (!lat || !payload || binder_open(&bs) < 0)
+		goto err_kill;
+
+	/* warm up: the first transactions fault in the buffer pages */
+	for (i = 0; i < 16; i++)
+		if (transact(&bs, PINGPONG_PING, payload, size, &reply_buf))
+			goto err_kill;
+
+	for (i = 0; i < iters; i++) {
+		uint64_t start = now_ns();
+
+		if (transact(&bs, PINGPONG_PING, payload, size, &reply_buf))
+			goto err_kill;
+		lat[i] = now_ns() - start;
+		total += lat[i];
+	}
+	transact(&bs, PINGPONG_QUIT, payload, 0, &reply_buf);
+	waitpid(pid, &status, 0);
+
+	qsort(lat, iters, sizeof(*lat), cmp_ns);
+	printf("%lu round trips, %zu byte payload\n", iters, size);
+	printf("min %llu us, avg %llu us, 50%% %llu us, 99%% %llu us, "
+	       "max %llu us\n",
+	       (unsigned long long)lat[0] / 1000,
+	       (unsigned long long)(total / iters) / 1000,
+	       (unsigned long long)lat[iters / 2] / 1000,
+	       (unsigned long long)lat[iters - 1 - iters / 100] / 1000,
+	       (unsigned long long)lat[iters - 1] / 1000);
+	return 0;
+
+err_kill:
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return 1;
+}